@@ -3,11 +3,17 @@
 /// \file
 /// The file contains token enumeration and auxilliary functions
 ///
+/// All the tables here are generated from \c TokenKinds.def as \c constexpr data, so the functions
+/// are inlined into hot loops of their clients without any call overhead.
+///
 //------------------------------------------------------------------------------------------------//
 
 #ifndef DZIEJA_BASIC_TOKENKINDS_H
 #define DZIEJA_BASIC_TOKENKINDS_H
 
+#include <cassert>
+#include <cstdint>
+
 namespace dzieja {
 
 namespace tok {
@@ -18,11 +24,107 @@ enum TokenKind : unsigned short {
     NUM_TOKENS
 };
 
+/// Lexer modes (start conditions) declared with the \c MODE macro. Every mode has its own DFA, and
+/// the lexer starts in the first one.
+enum LexMode : uint8_t {
+#define MODE(name) mode_##name,
+#include "dzieja/Basic/TokenKinds.def"
+    NUM_MODES
+};
+
+/// Categories of tokens. A token kind can belong to one category at most.
+enum TokenCategory : uint8_t {
+    TC_None = 0,
+    TC_Keyword = 1 << 0,
+    TC_Punctuator = 1 << 1,
+    TC_Trivia = 1 << 2,
+};
+
+namespace detail {
+
+constexpr const char *const TokenNames[] = {
+#define TOK(name) #name,
+#define KEYWORD(name) #name,
+#include "dzieja/Basic/TokenKinds.def"
+};
+
+// the lengths are kept in bytes
+#define TOK(name)                                                                                  \
+    static_assert(sizeof(#name) - 1 <= UINT8_MAX, "name of token '" #name "' is too long");
+#define KEYWORD(name) TOK(name)
+#include "dzieja/Basic/TokenKinds.def"
+
+constexpr uint8_t TokenNameLengths[] = {
+#define TOK(name) sizeof(#name) - 1,
+#define KEYWORD(name) sizeof(#name) - 1,
+#include "dzieja/Basic/TokenKinds.def"
+};
+
+constexpr uint8_t TokenCategories[] = {
+#define TOK(name) TC_None,
+#define KEYWORD(name) TC_Keyword,
+#define PUNCTUATOR(name, str) TC_Punctuator,
+#define TRIVIA(name, regex) TC_Trivia,
+#include "dzieja/Basic/TokenKinds.def"
+};
+
+static_assert(sizeof(TokenNames) / sizeof(TokenNames[0]) == NUM_TOKENS,
+              "token name table doesn't match TokenKind enumeration");
+static_assert(sizeof(TokenCategories) == NUM_TOKENS,
+              "token category table doesn't match TokenKind enumeration");
+
+} // namespace detail
+
 /// Returns name of token.
 ///
 /// For an identifier returns identifier itself. For a keyword returns keyword without \c kw_
 /// prefix. For a punctuator returns punctuator's name as its enum variable name.
-const char *getTokenName(TokenKind kind);
+constexpr const char *getTokenName(TokenKind kind)
+{
+    assert(kind < NUM_TOKENS && "unknown TokenKind");
+    return detail::TokenNames[kind];
+}
+
+/// Returns length of the string returned by \p getTokenName.
+constexpr unsigned getTokenNameLength(TokenKind kind)
+{
+    assert(kind < NUM_TOKENS && "unknown TokenKind");
+    return detail::TokenNameLengths[kind];
+}
+
+constexpr TokenCategory getTokenCategory(TokenKind kind)
+{
+    assert(kind < NUM_TOKENS && "unknown TokenKind");
+    return (TokenCategory)detail::TokenCategories[kind];
+}
+
+constexpr bool isKeyword(TokenKind kind) { return getTokenCategory(kind) & TC_Keyword; }
+constexpr bool isPunctuator(TokenKind kind) { return getTokenCategory(kind) & TC_Punctuator; }
+constexpr bool isTrivia(TokenKind kind) { return getTokenCategory(kind) & TC_Trivia; }
+
+/// Set of token kinds as a bit mask. It can be used only if there are no more than 64 kinds.
+using KindMask = uint64_t;
+
+constexpr bool KindMaskIsUsable = NUM_TOKENS <= 64;
+
+constexpr KindMask getKindMask(TokenKind kind) { return KindMask(1) << (kind & 63); }
+
+template<typename... Kinds>
+constexpr KindMask getKindMask(TokenKind K1, TokenKind K2, Kinds... Ks)
+{
+    return getKindMask(K1) | getKindMask(K2, Ks...);
+}
+
+constexpr bool isOneOf(TokenKind kind, TokenKind K) { return kind == K; }
+
+/// Checks if \p kind is one of the listed kinds. If all the kinds fit into \c KindMask, it is a
+/// single test of a constant mask, otherwise it is a chain of comparisons.
+template<typename... Kinds>
+constexpr bool isOneOf(TokenKind kind, TokenKind K1, TokenKind K2, Kinds... Ks)
+{
+    return KindMaskIsUsable ? (getKindMask(K1, K2, Ks...) >> (kind & 63)) & 1
+                            : kind == K1 || isOneOf(kind, K2, Ks...);
+}
 
 } // namespace tok
 
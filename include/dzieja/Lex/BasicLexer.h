@@ -0,0 +1,184 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains \c BasicLexer — the lexer configured at compile time.
+///
+/// \c Lexer checks its settings at runtime on every token. \c BasicLexer takes the DFA and the
+/// settings as template parameters, so every configuration is compiled into its own loop without
+/// any checks of settings, and the DFA tables are \c constexpr data visible to the optimizer.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEX_BASICLEXER_H
+#define DZIEJA_LEX_BASICLEXER_H
+
+#include "dzieja/Basic/TokenKinds.h"
+#include "dzieja/Lex/LexDFA.h"
+#include "dzieja/Lex/LexGrammar.h"
+#include "dzieja/Lex/Token.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cassert>
+
+namespace dzieja {
+
+namespace detail {
+
+/// Reports that no token starts with the symbol at \p ptr and exits.
+[[noreturn]] void reportUnexpectedSymbol(const char *ptr);
+
+} // namespace detail
+
+/// Default settings of \c BasicLexer. A custom policy can derive from it and hide the members it
+/// changes.
+struct DefaultLexerPolicy {
+    /// If true, \c comment tokens are returned, otherwise they are skipped like gaps are.
+    static constexpr bool RetainComments = false;
+
+    /// If true, the lexer counts lines and columns of tokens.
+    static constexpr bool TrackLocation = false;
+
+    /// If true, a symbol no token starts with is returned as a \c tok::unknown token of one byte.
+    /// Otherwise an error is reported and the program exits as \c Lexer does.
+    static constexpr bool RecoverFromErrors = false;
+
+    /// If false, the buffer needn't be terminated with the null, and it is lexed with
+    /// \c matchLongestTokenInRange. The \c eof token is empty then, and it is returned at the end
+    /// of the buffer again and again.
+    static constexpr bool RequiresNullTerminator = true;
+};
+
+/// Lexer specialized at compile time with a \p DFA generated by dzieja-lexgen (e.g. \c LexDFA) and
+/// a \p Policy with the same members as \c DefaultLexerPolicy has.
+template<typename DFA = LexDFA, typename Policy = DefaultLexerPolicy>
+class BasicLexer {
+    const char *BufferStart;
+    const char *BufferEnd;
+    const char *BufferPtr;
+
+    /// Current mode of the DFA, see \c tok::LexMode.
+    unsigned Mode = 0;
+
+    /// Location of the current position and of the last token. They are updated only if
+    /// \c Policy::TrackLocation is true. Lines and columns are counted from 1, columns in bytes.
+    unsigned Line = 1;
+    const char *LineStart;
+    unsigned TokenLine = 1;
+    unsigned TokenColumn = 1;
+
+public:
+    BasicLexer(const char *bufferStart, const char *bufferPtr, const char *bufferEnd)
+        : BufferStart(bufferStart), BufferEnd(bufferEnd), BufferPtr(bufferPtr)
+    {
+        assert((!Policy::RequiresNullTerminator || BufferEnd[0] == '\0')
+               && "expected null at the end of the buffer");
+
+        // Skip a UTF-8 BOM in the beginning of the buffer
+        if (BufferStart == BufferPtr) {
+            llvm::StringRef buffer(BufferStart, BufferEnd - BufferStart);
+            if (buffer.startswith("\xEF\xBB\xBF")) {
+                BufferStart += 3;
+                BufferPtr += 3;
+            }
+        }
+        LineStart = BufferPtr;
+    }
+
+    explicit BasicLexer(const llvm::MemoryBuffer *inputFile)
+        : BasicLexer(inputFile->getBufferStart(), inputFile->getBufferStart(),
+                     inputFile->getBufferEnd())
+    {
+    }
+
+    BasicLexer(const BasicLexer &) = delete;
+    BasicLexer &operator=(const BasicLexer &) = delete;
+
+    /// Reads next token from an input buffer. Depending on the policy it can skip comment tokens.
+    void lex(Token &result)
+    {
+        do {
+            lexInternal(result);
+        } while (Policy::RetainComments ? result.is(tok::gap)
+                                        : result.isOneOf(tok::gap, tok::comment));
+    }
+
+    const char *getBufferStart() const { return BufferStart; }
+    const char *getBufferEnd() const { return BufferEnd; }
+
+    /// Switches the lexer to another mode of the DFA starting from the next token.
+    void setMode(unsigned mode) { Mode = mode; }
+    unsigned getMode() const { return Mode; }
+
+    /// Returns line of the last token returned by \p lex.
+    unsigned getTokenLine() const
+    {
+        static_assert(Policy::TrackLocation, "location tracking is disabled by the policy");
+        return TokenLine;
+    }
+
+    /// Returns column of the last token returned by \p lex.
+    unsigned getTokenColumn() const
+    {
+        static_assert(Policy::TrackLocation, "location tracking is disabled by the policy");
+        return TokenColumn;
+    }
+
+private:
+    /// Reads next token from an input buffer with maximal munch.
+    void lexInternal(Token &result)
+    {
+        const char *tokStartPtr = BufferPtr;
+        unsigned kind;
+        const char *tokEndPtr;
+        bool isMatched;
+        if (Policy::RequiresNullTerminator) {
+            tokEndPtr = matchLongestToken<DFA>(tokStartPtr, kind, Mode);
+            isMatched = tokEndPtr != tokStartPtr;
+        }
+        else {
+            tokEndPtr = matchLongestTokenInRange<DFA>(tokStartPtr, BufferEnd, kind, Mode);
+            isMatched = tokEndPtr != nullptr;
+        }
+        if (!isMatched) {
+            // there is nothing to skip at the end of the buffer, and the lexer never steps past
+            // it, so eof is returned in the first mode
+            bool isAtEnd = tokStartPtr == BufferEnd;
+            if (!Policy::RecoverFromErrors)
+                detail::reportUnexpectedSymbol(isAtEnd ? "" : tokStartPtr);
+            tokEndPtr = isAtEnd ? tokStartPtr : tokStartPtr + 1;
+            kind = isAtEnd ? tok::eof : tok::unknown;
+            Mode = isAtEnd ? 0 : Mode;
+        }
+
+        BufferPtr = tokEndPtr;
+        if (tokEndPtr > BufferEnd) {
+            // the lexer never steps past the null terminator: eof is returned on it again and
+            // again, and other tokens matching the null end before it
+            BufferPtr = BufferEnd;
+            tokEndPtr = kind == tok::eof ? tokEndPtr : BufferEnd;
+        }
+        result.setBufferPtr(tokStartPtr);
+        result.setLength(tokEndPtr - tokStartPtr);
+        result.setKind((tok::TokenKind)kind);
+        if (Policy::TrackLocation)
+            updateLocation(tokStartPtr, tokEndPtr);
+    }
+
+    void updateLocation(const char *tokStartPtr, const char *tokEndPtr)
+    {
+        TokenLine = Line;
+        TokenColumn = tokStartPtr - LineStart + 1;
+        for (const char *ptr = tokStartPtr; ptr != tokEndPtr; ++ptr) {
+            if (*ptr == '\n') {
+                ++Line;
+                LineStart = ptr + 1;
+            }
+        }
+    }
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEX_BASICLEXER_H
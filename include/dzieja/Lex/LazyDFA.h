@@ -0,0 +1,156 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains \c LazyDFA — a DFA that is built from an NFA on demand while lexing.
+///
+/// dzieja-lexgen builds all the states of a DFA by the subset construction, and for some grammars
+/// there are too many of them to be built at all. \c LazyDFA takes the NFA written by dzieja-lexgen
+/// with \c -emit-nfa and determinizes only the states the input reaches. They are kept in a cache
+/// of a bounded size, which is flushed when it is full. If the cache is flushed too often, the rest
+/// of a token is matched by simulating the NFA. So memory is bounded for any grammar, and on usual
+/// input the lexer runs over the cached transitions at the speed of a table DFA.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEX_LAZYDFA_H
+#define DZIEJA_LEX_LAZYDFA_H
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace dzieja {
+
+class LazyDFA {
+    using StateSet = llvm::SmallVector<unsigned, 0>;
+
+    /// Transition of the NFA on the symbols [Lo, Hi].
+    struct NFAEdge {
+        uint8_t Lo;
+        uint8_t Hi;
+        unsigned Target;
+    };
+
+    struct NFAState {
+        unsigned short Kind = 0;
+        unsigned NextMode = KeepMode;
+        llvm::SmallVector<NFAEdge, 2> Edges;
+        llvm::SmallVector<unsigned, 2> EpsilonTargets;
+    };
+
+    /// Cached state of the DFA: a set of NFA states closed under epsilon edges. The set is the key
+    /// of \c StateIDs, and the state refers to it.
+    struct DFAState {
+        const StateSet *Set;
+        unsigned short Kind;
+        unsigned NextMode;
+    };
+
+    /// The longest token matched so far.
+    struct Match {
+        const char *End;
+        unsigned short Kind;
+        unsigned NextMode;
+    };
+
+    enum : unsigned { KeepMode = ~0u, UnknownState = ~0u, DeadState = ~0u - 1 };
+
+    /// If less bytes per cached state are lexed between two flushes, the cache is considered
+    /// thrashing, and the token is matched by the NFA simulation.
+    enum : unsigned { MinBytesPerState = 10 };
+
+    llvm::SmallVector<NFAState, 0> NFAStates;
+    llvm::SmallVector<unsigned, 0> NFAModeStarts;
+
+    /// Symbols that are not distinguished by any edge of the NFA share a class, and rows of the
+    /// transitive table are indexed by classes.
+    uint8_t ByteClasses[256] = {};
+    unsigned NumClasses = 0;
+
+    std::map<StateSet, unsigned> StateIDs;
+    llvm::SmallVector<DFAState, 0> States;
+
+    /// Transitive table of the cached states: a target state, \c DeadState or \c UnknownState for
+    /// not yet built transitions.
+    llvm::SmallVector<unsigned, 0> Transitions;
+
+    /// Cached start states of modes, or \c UnknownState.
+    llvm::SmallVector<unsigned, 0> ModeStarts;
+
+    size_t CacheBudget;
+    size_t CacheSize = 0;
+    uint64_t BytesSinceFlush = 0;
+    uint64_t NumFlushes = 0;
+    uint64_t NumNFASteps = 0;
+
+    /// Scratch of the closure: visited NFA states are marked with the current generation.
+    llvm::SmallVector<unsigned, 0> Marks;
+    unsigned Generation = 0;
+    llvm::SmallVector<unsigned, 0> Stack;
+
+    /// The last set built by \p step or \p getStartState.
+    StateSet NextSet;
+
+public:
+    enum : size_t { DefaultCacheBudget = 8 << 20 };
+
+    /// Makes an empty DFA whose cached states take about \p cacheBudget bytes at most.
+    explicit LazyDFA(size_t cacheBudget = DefaultCacheBudget) : CacheBudget(cacheBudget) {}
+
+    LazyDFA(const LazyDFA &) = delete;
+    LazyDFA &operator=(const LazyDFA &) = delete;
+
+    /// Reads the NFA written by dzieja-lexgen with \c -emit-nfa from \p text and flushes the cache.
+    /// Returns false and the reason via \p error if the text is malformed.
+    bool read(llvm::StringRef text, std::string &error);
+
+    /// Matches the longest token starting at \p ptr in lexer mode \p mode as
+    /// \c LexGrammar::MatchFunction does. Returns the end of the token and its kind via \p kind, or
+    /// \p ptr if no token matches. If the token switches the mode, \p mode is updated.
+    const char *matchLongestToken(const char *ptr, unsigned &kind, unsigned &mode);
+
+    size_t getNumNFAStates() const { return NFAStates.size(); }
+    size_t getNumModes() const { return NFAModeStarts.size(); }
+    size_t getNumCachedStates() const { return States.size(); }
+    size_t getCacheSize() const { return CacheSize; }
+    uint64_t getNumFlushes() const { return NumFlushes; }
+
+    /// Returns the number of symbols matched by the NFA simulation instead of cached states.
+    uint64_t getNumNFASteps() const { return NumNFASteps; }
+
+private:
+    void flush();
+
+    /// Clears \c NextSet and the marks of visited states before a new closure.
+    void beginClosure();
+
+    /// Adds \p id and the states reachable from it by epsilon edges to \p set.
+    void addClosure(unsigned id, StateSet &set);
+
+    /// Builds the closed set of targets of \p set on \p symbol into \c NextSet.
+    void step(const StateSet &set, unsigned char symbol);
+
+    /// Returns the NFA state of the token accepted in \p set, or \c UnknownState if the set isn't
+    /// accepting. The first token of the grammar has the highest priority, and its states have
+    /// lesser IDs.
+    unsigned findAccepted(const StateSet &set) const;
+
+    /// Returns the cached state of \c NextSet and caches it if needed. If the cache is thrashing
+    /// or the state doesn't fit, returns \c UnknownState.
+    unsigned addState();
+
+    unsigned getStartState(unsigned mode);
+    unsigned addTransition(unsigned id, unsigned char symbol);
+
+    /// Continues the match from \c NextSet reached at \p ptr without the cache. If \c NextSet is
+    /// reached by the null, \p isAfterNull is true, and the match ends there.
+    const char *simulateNFA(const char *ptr, Match &match, bool isAfterNull);
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEX_LAZYDFA_H
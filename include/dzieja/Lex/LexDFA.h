@@ -0,0 +1,27 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file gives access to the DFA generated with the dzieja-lexgen util from the
+/// dzieja/Basic/TokenKinds.def source.
+///
+/// The DFA is available as \c LexDFA structure with \c constexpr tables, that is used by
+/// \c BasicLexer, and as \c DFA_delta, \c DFA_getKind, \c DFA_getCanonicalStateID,
+/// \c DFA_getStartStateID, \c DFA_getNextMode functions and \c DFA_StartStateID,
+/// \c DFA_InvalidStateID, \c DFA_AcceptFlag, \c DFA_NumModes constants.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEX_LEXDFA_H
+#define DZIEJA_LEX_LEXDFA_H
+
+// these two headers are needed for LexDFAImpl.inc
+#include <cassert>
+#include <cstdint>
+
+namespace dzieja {
+
+#include "dzieja/Basic/LexDFAImpl.inc"
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEX_LEXDFA_H
@@ -0,0 +1,269 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains \c LexGrammar — a grammar the \c Lexer can be switched to at runtime.
+///
+/// Every grammar is a DFA generated by dzieja-lexgen with its own \c -prefix from its own \c .def
+/// file, e.g. for an embedded sublanguage. The lexer calls the grammar's matching function once per
+/// token, so there is no indirect call in the per-byte loop, and every grammar has its own small
+/// tables.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEX_LEXGRAMMAR_H
+#define DZIEJA_LEX_LEXGRAMMAR_H
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <cassert>
+#include <type_traits>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+namespace dzieja {
+
+namespace detail {
+
+/// Implementation of \c matchLongestToken with the transitive function of the DFA.
+template<typename DFA>
+inline const char *matchLongestToken(const char *ptr, unsigned &kind, unsigned &mode,
+                                     std::false_type /*hasShuffleTable*/)
+{
+    unsigned stateID = DFA::getStartStateID(mode);
+    unsigned acceptID = stateID;
+    const char *acceptPtr = ptr;
+    char symbol;
+
+    do {
+        symbol = *ptr++;
+        stateID = DFA::delta(stateID, symbol);
+        bool isAccepting = stateID & DFA::AcceptFlag;
+        acceptPtr = isAccepting ? ptr : acceptPtr;
+        acceptID = isAccepting ? stateID : acceptID;
+    } while (stateID != DFA::InvalidStateID && symbol != '\0');
+
+    kind = DFA::getKind(acceptID);
+    mode = DFA::getNextMode(acceptID, mode);
+    return acceptPtr;
+}
+
+/// Implementation of \c matchLongestToken for a DFA generated with \c -gen-via-shuffle (Sheng
+/// algorithm). The current state is kept in all the lanes of a vector, and a transition is one
+/// byte shuffle of the symbol's row of \c DFA::ShuffleTable. The row doesn't depend on the state,
+/// so it is loaded ahead, and the dependency chain between bytes is the shuffle only.
+template<typename DFA>
+inline const char *matchLongestToken(const char *ptr, unsigned &kind, unsigned &mode,
+                                     std::true_type /*hasShuffleTable*/)
+{
+#ifdef __SSSE3__
+    unsigned stateID = DFA::getStartStateID(mode);
+    unsigned acceptID = stateID;
+    const char *acceptPtr = ptr;
+    __m128i state = _mm_set1_epi8((char)stateID);
+    char symbol;
+
+    do {
+        symbol = *ptr++;
+        const auto *row = (const __m128i *)DFA::ShuffleTable[(unsigned char)symbol];
+        state = _mm_shuffle_epi8(_mm_load_si128(row), state);
+        stateID = (unsigned)_mm_cvtsi128_si32(state) & 0xffu;
+        bool isAccepting = stateID & DFA::ShuffleAcceptFlag;
+        acceptPtr = isAccepting ? ptr : acceptPtr;
+        acceptID = isAccepting ? stateID : acceptID;
+    } while (stateID != DFA::InvalidStateID && symbol != '\0');
+
+    acceptID &= DFA::ShuffleAcceptFlag - 1u;
+    kind = DFA::getKind(acceptID);
+    mode = DFA::getNextMode(acceptID, mode);
+    return acceptPtr;
+#else
+    return matchLongestToken<DFA>(ptr, kind, mode, std::false_type());
+#endif
+}
+
+} // namespace detail
+
+/// Matches the longest token starting at \p ptr with \p DFA (e.g. \c LexDFA) in lexer mode
+/// \p mode. Returns the end of the token and its kind via \p kind, or \p ptr if no token matches.
+/// If the token switches the mode, \p mode is updated.
+///
+/// Transitions into accepting states are marked with \c DFA::AcceptFlag, so the last accept point
+/// is tracked with conditional moves instead of a branch or a kind lookup per byte. A DFA with the
+/// shuffle table is run with SIMD shuffles if the target supports SSSE3.
+///
+/// The DFA stops on the null: it terminates the buffer, so no token continues after it, and the
+/// byte after it is never read.
+template<typename DFA>
+inline const char *matchLongestToken(const char *ptr, unsigned &kind, unsigned &mode)
+{
+    return detail::matchLongestToken<DFA>(
+        ptr, kind, mode, std::integral_constant<bool, DFA::HasShuffleTable != 0>());
+}
+
+/// Matches the longest token starting at \p ptr as \c matchLongestToken does, but in the range
+/// [\p ptr, \p end) which needn't be terminated with the null, e.g. a slice of a larger buffer.
+/// Bytes from \p end on are never read: the DFA steps on a null there instead, as if the range were
+/// terminated, and a token including that null ends at \p end. So at the end of the range the
+/// \c eof token is empty. Returns the end of the token, or null if no token matches. If
+/// \p numSteps isn't null, the number of transitions the DFA made is stored there.
+///
+/// Far from \p end the DFA runs in blocks of \c BlockSize bytes with the bounds checked once per
+/// block, and only the last bytes of the range are checked one by one, so a token costs about one
+/// extra comparison. The transitive function is used even if \p DFA has the shuffle table.
+template<typename DFA>
+inline const char *matchLongestTokenInRange(const char *ptr, const char *end, unsigned &kind,
+                                            unsigned &mode, unsigned *numSteps = nullptr)
+{
+    enum { BlockSize = 16 };
+    unsigned stateID = DFA::getStartStateID(mode);
+    unsigned acceptID = stateID;
+    const char *startPtr = ptr;
+    const char *acceptPtr = ptr;
+
+    // the DFA stops on a null inside the range too, as it does in a terminated buffer
+    auto step = [&](char symbol) {
+        stateID = DFA::delta(stateID, symbol);
+        bool isAccepting = stateID & DFA::AcceptFlag;
+        acceptPtr = isAccepting ? ptr : acceptPtr;
+        acceptID = isAccepting ? stateID : acceptID;
+        return stateID != DFA::InvalidStateID && symbol != '\0';
+    };
+
+    bool isRunning = true;
+    while (isRunning && end - ptr >= BlockSize) {
+        for (unsigned i = 0; i < BlockSize && isRunning; i++)
+            isRunning = step(*ptr++);
+    }
+    while (isRunning && ptr != end)
+        isRunning = step(*ptr++);
+    if (isRunning)
+        step('\0');
+    // the step on the null at the end doesn't read a byte, so it is counted separately
+    if (numSteps)
+        *numSteps = (ptr - startPtr) + (isRunning ? 1 : 0);
+
+    if (!(acceptID & DFA::AcceptFlag))
+        return nullptr;
+    kind = DFA::getKind(acceptID);
+    mode = DFA::getNextMode(acceptID, mode);
+    return acceptPtr;
+}
+
+/// Memo of \c matchLongestTokenLinear for one buffer: pairs of a DFA state and a position from
+/// which the DFA doesn't reach any accepting state. It takes one bit per state per byte of the
+/// buffer.
+class MaximalMunchMemo {
+    llvm::BitVector FailedPairs;
+    const char *BufferStart = nullptr;
+    const char *BufferEnd = nullptr;
+    unsigned NumStates = 0;
+
+public:
+    MaximalMunchMemo() = default;
+
+    /// Makes the memo for the buffer [\p bufferStart, \p bufferEnd] ending with the null and for
+    /// states [0, \p numStates). The DFA stops on the null, so no position after it is visited.
+    MaximalMunchMemo(const char *bufferStart, const char *bufferEnd, unsigned numStates)
+    {
+        reset(bufferStart, bufferEnd, numStates);
+    }
+
+    void reset(const char *bufferStart, const char *bufferEnd, unsigned numStates)
+    {
+        assert(bufferStart <= bufferEnd && "invalid buffer");
+        BufferStart = bufferStart;
+        BufferEnd = bufferEnd;
+        NumStates = numStates;
+        FailedPairs.clear();
+        FailedPairs.resize((bufferEnd - bufferStart + 1) * numStates);
+    }
+
+    bool isFailed(unsigned stateID, const char *ptr) const
+    {
+        return FailedPairs.test(getIndex(stateID, ptr));
+    }
+
+    void setFailed(unsigned stateID, const char *ptr) { FailedPairs.set(getIndex(stateID, ptr)); }
+
+private:
+    size_t getIndex(unsigned stateID, const char *ptr) const
+    {
+        assert(BufferStart <= ptr && ptr <= BufferEnd && "the position is out of the buffer");
+        assert(stateID < NumStates && "unknown state");
+        return (size_t)(ptr - BufferStart) * NumStates + stateID;
+    }
+};
+
+/// Matches the longest token as \c matchLongestToken does, but in O(n) time for the whole buffer
+/// with any grammar (Reps' tabulating scanner). \p memo must cover the buffer and the states of
+/// \p DFA, and it must be shared by all the tokens of the buffer. If \p numSteps isn't null, the
+/// number of transitions the DFA made is stored there.
+///
+/// \c matchLongestToken backtracks to the last accepting state, and for grammars like \c a|a*b an
+/// input of \c n letters \c a takes O(n^2) steps. Here every (state, position) pair visited after
+/// the last accepting state is remembered as failed, and later tokens stop on such a pair instead
+/// of scanning the same bytes again, so every pair is visited at most once.
+template<typename DFA>
+inline const char *matchLongestTokenLinear(const char *ptr, unsigned &kind, unsigned &mode,
+                                           MaximalMunchMemo &memo, unsigned *numSteps = nullptr)
+{
+    unsigned stateID = DFA::getStartStateID(mode);
+    unsigned acceptID = stateID;
+    const char *startPtr = ptr;
+    const char *acceptPtr = ptr;
+
+    // states visited since the last accepting one, the first of them at acceptPtr
+    llvm::SmallVector<unsigned, 32> trail;
+    char symbol;
+    do {
+        unsigned id = stateID & (DFA::AcceptFlag - 1u);
+        if (memo.isFailed(id, ptr))
+            break;
+        trail.push_back(id);
+        symbol = *ptr++;
+        stateID = DFA::delta(stateID, symbol);
+        if (stateID & DFA::AcceptFlag) {
+            acceptPtr = ptr;
+            acceptID = stateID;
+            trail.clear();
+        }
+    } while (stateID != DFA::InvalidStateID && symbol != '\0');
+
+    for (size_t i = 0; i < trail.size(); i++)
+        memo.setFailed(trail[i], acceptPtr + i);
+    if (numSteps)
+        *numSteps = ptr - startPtr;
+
+    kind = DFA::getKind(acceptID);
+    mode = DFA::getNextMode(acceptID, mode);
+    return acceptPtr;
+}
+
+/// Grammar the \c Lexer can be switched to with \c Lexer::setGrammar.
+///
+/// Kinds are values of the grammar's own kind enumeration, built from its \c .def file as
+/// \c tok::TokenKind is built from \c TokenKinds.def.
+struct LexGrammar {
+    using MatchFunction = const char *(*)(const char *ptr, unsigned &kind, unsigned &mode);
+
+    MatchFunction MatchToken;
+
+    /// Kinds of tokens the lexer skips: gaps always, comments unless comment retention mode is
+    /// enabled. 0 means the grammar has no such token.
+    unsigned short GapKind;
+    unsigned short CommentKind;
+};
+
+/// Makes a grammar from a DFA generated by dzieja-lexgen, e.g. \c makeLexGrammar<CfgLexDFA>(...).
+template<typename DFA>
+constexpr LexGrammar makeLexGrammar(unsigned short gapKind, unsigned short commentKind)
+{
+    return {&matchLongestToken<DFA>, gapKind, commentKind};
+}
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEX_LEXGRAMMAR_H
@@ -1,13 +1,18 @@
 #ifndef DZIEJA_LEX_LEXER_H
 #define DZIEJA_LEX_LEXER_H
 
+#include <cstdint>
+#include <memory>
+
 namespace llvm {
 class MemoryBuffer;
 }
 
 namespace dzieja {
 
+class MaximalMunchMemo;
 class Token;
+struct LexGrammar;
 
 class Lexer {
     const char *BufferStart;
@@ -17,9 +22,34 @@ class Lexer {
     /// If this mode is enabled \p lex method returns \c comment tokens too.
     bool InCommentRetentionMode = false;
 
+    /// Grammar the lexer is switched to, or null for the grammar of \c TokenKinds.def.
+    const LexGrammar *Grammar = nullptr;
+
+    /// Current mode of the grammar. For the grammar of \c TokenKinds.def it is \c tok::LexMode.
+    unsigned Mode = 0;
+
+    /// Memo of the linear-time mode, or null if the mode is disabled.
+    std::unique_ptr<MaximalMunchMemo> Memo;
+
+    /// If false, the buffer needn't be terminated with the null, and it is lexed with
+    /// \c matchLongestTokenInRange, which never reads \c BufferEnd.
+    bool RequiresNullTerminator;
+
+    /// Transitions of the DFA of \c TokenKinds.def in total and for the last token, see
+    /// \p getNumSteps and \p getTokenSteps.
+    uint64_t NumSteps = 0;
+    unsigned TokenSteps = 0;
+
 public:
-    Lexer(const char *bufferStart, const char *bufferPtr, const char *bufferEnd);
+    /// Makes the lexer of the buffer [\p bufferStart, \p bufferEnd) starting at \p bufferPtr. If
+    /// \p requiresNullTerminator is true, \p bufferEnd must point to the null, which is lexed as
+    /// the \c eof token. Otherwise the buffer can be any range, e.g. a slice of a larger buffer,
+    /// and the \c eof token is empty and is returned at the end of the range again and again. Such
+    /// a lexer can't be switched to other grammars or to the linear-time mode.
+    Lexer(const char *bufferStart, const char *bufferPtr, const char *bufferEnd,
+          bool requiresNullTerminator = true);
     explicit Lexer(const llvm::MemoryBuffer *inputFile);
+    ~Lexer();
 
     Lexer(const Lexer &) = delete;
     Lexer &operator=(const Lexer &) = delete;
@@ -27,16 +57,64 @@ public:
     /// Reads next token from an input buffer. Depending on the settings it can skip comment tokens.
     void lex(Token &result);
 
+    const char *getBufferStart() const { return BufferStart; }
+    const char *getBufferEnd() const { return BufferEnd; }
+    bool requiresNullTerminator() const { return RequiresNullTerminator; }
+
     void enableCommentRetentionMode() { InCommentRetentionMode = true; }
     void disableCommentRetentionMode() { InCommentRetentionMode = false; }
     bool inCommentRetentionMode() const { return InCommentRetentionMode; }
 
+    /// In the linear-time mode the lexer matches tokens of the grammar of \c TokenKinds.def with
+    /// \c matchLongestTokenLinear, so lexing of the rest of the buffer takes O(n) time for any
+    /// input, e.g. an untrusted one. The memo takes one bit per DFA state per byte of the rest of
+    /// the buffer. Grammars set by \p setGrammar aren't affected.
+    void enableLinearTimeMode();
+    void disableLinearTimeMode();
+    bool inLinearTimeMode() const { return (bool)Memo; }
+
+    /// Switches the lexer to another grammar starting from the next token, e.g. to lex a
+    /// sublanguage embedded into the main one. Null switches it back to the grammar of
+    /// \c TokenKinds.def. Kinds of tokens lexed with another grammar are values of that grammar's
+    /// kind enumeration.
+    ///
+    /// The lexer starts in the first mode of the grammar.
+    void setGrammar(const LexGrammar *grammar)
+    {
+        Grammar = grammar;
+        Mode = 0;
+    }
+    const LexGrammar *getGrammar() const { return Grammar; }
+
+    /// Switches the lexer to another mode of the current grammar starting from the next token.
+    /// Usually modes are switched by the tokens declared with \c TOKEN_TO_MODE.
+    void setMode(unsigned mode) { Mode = mode; }
+    unsigned getMode() const { return Mode; }
+
+    /// Returns the number of transitions the DFA of \c TokenKinds.def made since the lexer was
+    /// made, including the ones on the bytes it backtracked over and on the symbols that stopped
+    /// it. Transitions of grammars set by \p setGrammar aren't counted.
+    uint64_t getNumSteps() const { return NumSteps; }
+
+    /// Returns the number of transitions made for the last token returned by \p lex, without the
+    /// ones for the skipped tokens before it.
+    unsigned getTokenSteps() const { return TokenSteps; }
+
 private:
     /// Reads next token from an input buffer.
     ///
     /// It reads every token includeing comments and gaps. \p lex method decides which token must be
     /// returned to the client code.
     void lexInternal(Token &result);
+
+    /// Reads next token as \p lexInternal does, but in the linear-time mode.
+    void lexInternalLinear(Token &result);
+
+    /// Reads next token as \p lexInternal does, but without the null terminator.
+    void lexInternalInRange(Token &result);
+
+    /// Reads next token with the grammar set by \p setGrammar.
+    void lexWithGrammar(Token &result);
 };
 
 } // namespace dzieja
@@ -26,9 +26,9 @@ public:
     bool isOneOf(tok::TokenKind kind) const { return is(kind); }
 
     template<typename... Kinds>
-    bool isOneOf(tok::TokenKind K, Kinds... Ks) const
+    bool isOneOf(tok::TokenKind K1, tok::TokenKind K2, Kinds... Ks) const
     {
-        return is(K) || isOneOf(Ks...);
+        return tok::isOneOf(Kind, K1, K2, Ks...);
     }
 
     const char *getName() const { return tok::getTokenName(Kind); }
@@ -0,0 +1,169 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains the compact token representation and a container of such tokens.
+///
+/// \c Token keeps a pointer, a length, and a kind, that takes 16 bytes with padding. For big inputs
+/// it is too much, so \c TokenBuffer stores tokens as \c PackedToken — an 8-byte record with a
+/// 32-bit offset from the buffer start. \c TokenView restores the \c Token API on top of it.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEX_TOKENBUFFER_H
+#define DZIEJA_LEX_TOKENBUFFER_H
+
+#include "dzieja/Basic/TokenKinds.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cassert>
+#include <cstdint>
+
+namespace dzieja {
+
+class Lexer;
+class Token;
+class TokenBuffer;
+
+/// Compact representation of a lexed token.
+///
+/// The offset is counted from the beginning of a source buffer, so a buffer can't be bigger than
+/// 4 GiB, and \c TokenBuffer reports a fatal error for bigger ones. A length that doesn't fit into
+/// 16 bits is saved in the side table of the owning \c TokenBuffer, and here it is marked with
+/// \c LongLength.
+class PackedToken {
+    uint32_t Offset;
+    uint16_t Length;
+    tok::TokenKind Kind;
+
+    friend class TokenBuffer;
+
+public:
+    enum : uint16_t { LongLength = 0xffffu };
+
+    PackedToken(uint32_t offset, uint16_t length, tok::TokenKind kind)
+        : Offset(offset), Length(length), Kind(kind)
+    {
+    }
+
+    uint32_t getOffset() const { return Offset; }
+    tok::TokenKind getKind() const { return Kind; }
+    bool hasLongLength() const { return Length == LongLength; }
+};
+
+static_assert(sizeof(PackedToken) == 8, "PackedToken is expected to be 8 bytes long");
+
+/// Lightweight adapter giving access to a \c PackedToken with the same API as \c Token has.
+class TokenView {
+    const TokenBuffer *Buffer;
+    unsigned Index;
+
+public:
+    TokenView(const TokenBuffer &buffer, unsigned index) : Buffer(&buffer), Index(index) {}
+
+    inline tok::TokenKind getKind() const;
+
+    bool is(tok::TokenKind kind) const { return getKind() == kind; }
+    bool isOneOf(tok::TokenKind kind) const { return is(kind); }
+
+    template<typename... Kinds>
+    bool isOneOf(tok::TokenKind K1, tok::TokenKind K2, Kinds... Ks) const
+    {
+        return tok::isOneOf(getKind(), K1, K2, Ks...);
+    }
+
+    const char *getName() const { return tok::getTokenName(getKind()); }
+
+    inline const char *getBufferPtr() const;
+    inline unsigned getLength() const;
+
+    llvm::StringRef getSpelling() const { return {getBufferPtr(), getLength()}; }
+
+    unsigned getIndex() const { return Index; }
+};
+
+/// Container of packed tokens that belong to one source buffer.
+class TokenBuffer {
+    const char *BufferStart;
+    llvm::SmallVector<PackedToken, 0> Tokens;
+
+    /// Lengths of tokens that don't fit into \c PackedToken, indexed by the token's index.
+    llvm::DenseMap<unsigned, unsigned> LongLengths;
+
+public:
+    class iterator {
+        const TokenBuffer *Buffer;
+        unsigned Index;
+
+    public:
+        iterator(const TokenBuffer &buffer, unsigned index) : Buffer(&buffer), Index(index) {}
+
+        TokenView operator*() const { return TokenView(*Buffer, Index); }
+        iterator &operator++()
+        {
+            ++Index;
+            return *this;
+        }
+        bool operator==(const iterator &other) const { return Index == other.Index; }
+        bool operator!=(const iterator &other) const { return Index != other.Index; }
+    };
+
+    explicit TokenBuffer(const char *bufferStart) : BufferStart(bufferStart) {}
+
+    TokenBuffer(const TokenBuffer &) = delete;
+    TokenBuffer &operator=(const TokenBuffer &) = delete;
+
+    /// Appends a token. The token must point into the buffer this container is created for, at
+    /// most 4 GiB from its start, otherwise a fatal error is reported.
+    void push_back(const Token &token);
+
+    /// Reads tokens from the lexer until \c eof token inclusive.
+    void lexAll(Lexer &lexer);
+
+    void reserve(size_t numTokens) { Tokens.reserve(numTokens); }
+    void clear();
+
+    size_t size() const { return Tokens.size(); }
+    bool empty() const { return Tokens.empty(); }
+
+    TokenView operator[](unsigned index) const
+    {
+        assert(index < Tokens.size() && "token index is out of range");
+        return TokenView(*this, index);
+    }
+
+    iterator begin() const { return iterator(*this, 0); }
+    iterator end() const { return iterator(*this, Tokens.size()); }
+
+    const char *getBufferStart() const { return BufferStart; }
+    const PackedToken &getPackedToken(unsigned index) const { return Tokens[index]; }
+
+    /// Returns number of bytes occupied with tokens, including the side table of long lengths.
+    size_t getMemorySize() const
+    {
+        return Tokens.capacity_in_bytes() + LongLengths.getMemorySize();
+    }
+
+    unsigned getLength(unsigned index) const
+    {
+        const PackedToken &token = Tokens[index];
+        if (!token.hasLongLength())
+            return token.Length;
+        return LongLengths.find(index)->second;
+    }
+};
+
+tok::TokenKind TokenView::getKind() const { return Buffer->getPackedToken(Index).getKind(); }
+
+const char *TokenView::getBufferPtr() const
+{
+    return Buffer->getBufferStart() + Buffer->getPackedToken(Index).getOffset();
+}
+
+unsigned TokenView::getLength() const { return Buffer->getLength(Index); }
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEX_TOKENBUFFER_H
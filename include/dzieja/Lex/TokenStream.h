@@ -0,0 +1,127 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains \c TokenStream — a lookahead buffer over \c Lexer for parsers.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEX_TOKENSTREAM_H
+#define DZIEJA_LEX_TOKENSTREAM_H
+
+#include "dzieja/Lex/Token.h"
+
+#include <cassert>
+#include <cstddef>
+
+namespace dzieja {
+
+class Lexer;
+
+/// Token stream with a fixed-size ring buffer of lookahead tokens.
+///
+/// Tokens are read from the lexer in batches: when a client peeks behind the buffered tokens, the
+/// stream fills all the free slots of the ring at once. So the DFA of the lexer runs in bursts,
+/// and the parser gets tokens by reference without copying.
+///
+/// A client can remember the current position with \p mark and return to it with \p rewind. Marks
+/// must be released in LIFO order either with \p rewind or with \p commit. While there is an active
+/// mark, tokens after it are kept in the ring, so distance between the oldest mark and the farthest
+/// peeked token must be less than \c Capacity, otherwise a fatal error is reported.
+///
+/// After the \c eof token is read, the stream returns it for every further position.
+class TokenStream {
+public:
+    enum : unsigned { Capacity = 64 };
+
+    /// Position of a token in the stream.
+    using Mark = size_t;
+
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    enum : unsigned { Mask = Capacity - 1 };
+
+    Lexer &Lex;
+    Token Ring[Capacity];
+
+    /// Absolute position of the current token.
+    size_t Head = 0;
+
+    /// Absolute position after the last lexed token.
+    size_t Tail = 0;
+
+    /// Position of the oldest active mark. Tokens after it can't be overwritten.
+    size_t Anchor = 0;
+    unsigned NumMarks = 0;
+
+    bool ReachedEOF = false;
+
+public:
+    explicit TokenStream(Lexer &lexer) : Lex(lexer) {}
+
+    TokenStream(const TokenStream &) = delete;
+    TokenStream &operator=(const TokenStream &) = delete;
+
+    /// Returns the token which is \p k tokens after the current one. \c peek(0) is the current one.
+    const Token &peek(unsigned k = 0)
+    {
+        size_t pos = Head + k;
+        if (pos >= Tail) {
+            fill(pos);
+            if (pos >= Tail)
+                return Ring[(Tail - 1) & Mask]; // the eof token
+        }
+        return Ring[pos & Mask];
+    }
+
+    /// Moves to the next token. Consuming of \c eof doesn't change the position.
+    void consume()
+    {
+        if (peek().is(tok::eof))
+            return;
+        ++Head;
+    }
+
+    /// Returns the current token and moves to the next one. The reference is valid until the next
+    /// call of \p peek or \p next.
+    const Token &next()
+    {
+        const Token &token = peek();
+        consume();
+        return token;
+    }
+
+    Mark mark()
+    {
+        if (NumMarks++ == 0)
+            Anchor = Head;
+        return Head;
+    }
+
+    /// Returns to position \p m and releases the mark.
+    void rewind(Mark m)
+    {
+        assert(NumMarks && "there is no mark to rewind to");
+        assert(Anchor <= m && m <= Head && "the mark is not active");
+        Head = m;
+        --NumMarks;
+    }
+
+    /// Releases the mark \p m keeping the current position.
+    void commit(Mark m)
+    {
+        assert(NumMarks && "there is no mark to commit");
+        assert(Anchor <= m && m <= Head && "the mark is not active");
+        (void)m;
+        --NumMarks;
+    }
+
+    Lexer &getLexer() const { return Lex; }
+
+private:
+    /// Lexes tokens into all the free slots of the ring. \p pos is a position that is needed.
+    void fill(size_t pos);
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEX_TOKENSTREAM_H
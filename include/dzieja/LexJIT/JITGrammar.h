@@ -0,0 +1,93 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains \c JITGrammar — a \c LexGrammar compiled into native code at runtime.
+///
+/// A grammar generated by dzieja-lexgen into an \c .inc file reaches native code only with a
+/// rebuild of the program. \c JITGrammar takes a DFA at runtime, e.g. written by dzieja-lexgen with
+/// \c -emit-dfa, emits LLVM IR of a direct-coded scanner, where every state is a basic block and
+/// every transition is a branch, and compiles it with ORC. The lexer calls the compiled function as
+/// the grammar's matching function, so a grammar selected at runtime doesn't pay for interpreting
+/// the transitive table.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_LEXJIT_JITGRAMMAR_H
+#define DZIEJA_LEXJIT_JITGRAMMAR_H
+
+#include "dzieja/Lex/LexGrammar.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+class LLJIT;
+}
+} // namespace llvm
+
+namespace dzieja {
+
+/// DFA of a grammar independent of dzieja-lexgen. It can be filled in by a client or read from the
+/// text format that dzieja-lexgen writes with \c -emit-dfa.
+struct JITDFA {
+    /// Transition on the symbols [Lo, Hi].
+    struct Edge {
+        uint8_t Lo;
+        uint8_t Hi;
+        unsigned Target;
+    };
+
+    struct State {
+        /// Kind of the token accepted in the state, or 0 if the state is not accepting.
+        unsigned short Kind = 0;
+
+        /// Mode the lexer is switched to after a token accepted in the state, or \c KeepMode.
+        unsigned NextMode = KeepMode;
+
+        std::vector<Edge> Edges;
+    };
+
+    enum : unsigned { KeepMode = ~0u };
+
+    std::vector<State> States;
+
+    /// Start states indexed by lexer modes. There is at least one mode.
+    std::vector<unsigned> ModeStartStates;
+
+    /// Reads the DFA from \p text. Returns false and the reason via \p error if the text is
+    /// malformed or the automaton isn't deterministic.
+    bool read(llvm::StringRef text, std::string &error);
+};
+
+/// Grammar compiled from a \c JITDFA. It owns the compiled code, so it must outlive lexers that
+/// use it.
+class JITGrammar {
+    std::unique_ptr<llvm::orc::LLJIT> JIT;
+    LexGrammar Grammar;
+
+    JITGrammar();
+
+public:
+    ~JITGrammar();
+
+    JITGrammar(const JITGrammar &) = delete;
+    JITGrammar &operator=(const JITGrammar &) = delete;
+
+    /// Compiles \p dfa into the native code of the host. Tokens of \p gapKind and \p commentKind
+    /// are skipped by the lexer as \c LexGrammar describes. Returns null and the reason via
+    /// \p error if compilation fails.
+    static std::unique_ptr<JITGrammar> compile(const JITDFA &dfa, unsigned short gapKind,
+                                               unsigned short commentKind, std::string &error);
+
+    /// Returns the grammar to be passed to \c Lexer::setGrammar.
+    const LexGrammar &getGrammar() const { return Grammar; }
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_LEXJIT_JITGRAMMAR_H
@@ -0,0 +1,279 @@
+#include "dzieja/Lex/LazyDFA.h"
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/STLExtras.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+using namespace llvm;
+
+namespace dzieja {
+
+/// Approximate memory of a node of \c LazyDFA::StateIDs besides the set itself.
+static constexpr size_t MapNodeOverhead = 4 * sizeof(void *);
+
+bool LazyDFA::read(StringRef text, std::string &error)
+{
+    // The format of NFA::write of dzieja-lexgen:
+    //   automaton <number of states> <start state ID> <is DFA>
+    //   <kind> <number of edges> [<lo> <hi> <target>]...   -- one line for every state
+    //   modes <number of modes> <start state ID>...   -- only for several modes
+    //   next-modes <next mode>...   -- one number for every state, only if modes are switched
+    // An epsilon edge has the maximal unsigned value as the both bounds.
+    const unsigned epsilon = std::numeric_limits<unsigned>::max();
+    auto readNumber = [&text](unsigned &number) {
+        text = text.ltrim();
+        return !text.consumeInteger(10, number);
+    };
+    auto fail = [&error](const char *message) {
+        error = message;
+        return false;
+    };
+
+    NFAStates.clear();
+    NFAModeStarts.clear();
+    text = text.ltrim();
+    unsigned numStates, startID, isDFA;
+    if (!text.consume_front("automaton") || !readNumber(numStates) || !readNumber(startID)
+        || !readNumber(isDFA) || numStates == 0 || startID >= numStates)
+        return fail("malformed header of the automaton");
+
+    NFAStates.resize(numStates);
+    BitVector classStarts(257);
+    for (NFAState &state : NFAStates) {
+        unsigned kind, numEdges;
+        if (!readNumber(kind) || !readNumber(numEdges) || kind > UINT16_MAX)
+            return fail("malformed state of the automaton");
+        state.Kind = kind;
+        for (unsigned i = 0; i < numEdges; i++) {
+            unsigned lo, hi, target;
+            if (!readNumber(lo) || !readNumber(hi) || !readNumber(target) || target >= numStates)
+                return fail("malformed edge of the automaton");
+            if (lo == epsilon && hi == epsilon) {
+                state.EpsilonTargets.push_back(target);
+                continue;
+            }
+            if (lo > hi || hi > 255)
+                return fail("malformed edge of the automaton");
+            state.Edges.push_back({(uint8_t)lo, (uint8_t)hi, target});
+            classStarts.set(lo);
+            classStarts.set(hi + 1);
+        }
+    }
+
+    NFAModeStarts.push_back(startID);
+    text = text.ltrim();
+    if (text.consume_front("modes ")) {
+        unsigned numModes;
+        if (!readNumber(numModes) || numModes < 2)
+            return fail("malformed modes of the automaton");
+        NFAModeStarts.clear();
+        for (unsigned mode = 0; mode < numModes; mode++) {
+            unsigned id;
+            if (!readNumber(id) || id >= numStates)
+                return fail("malformed modes of the automaton");
+            NFAModeStarts.push_back(id);
+        }
+    }
+    text = text.ltrim();
+    if (text.consume_front("next-modes ")) {
+        for (NFAState &state : NFAStates) {
+            unsigned mode;
+            if (!readNumber(mode) || mode >= NFAModeStarts.size())
+                return fail("malformed modes of the automaton");
+            state.NextMode = state.Kind ? mode : KeepMode;
+        }
+    }
+
+    NumClasses = 0;
+    for (unsigned symbol = 0; symbol < 256; symbol++) {
+        if (symbol && classStarts[symbol])
+            ++NumClasses;
+        ByteClasses[symbol] = NumClasses;
+    }
+    ++NumClasses;
+
+    Marks.assign(numStates, 0);
+    Generation = 0;
+    flush();
+    NumFlushes = 0;
+    return true;
+}
+
+void LazyDFA::flush()
+{
+    StateIDs.clear();
+    States.clear();
+    Transitions.clear();
+    ModeStarts.assign(NFAModeStarts.size(), UnknownState);
+    CacheSize = 0;
+    BytesSinceFlush = 0;
+    ++NumFlushes;
+}
+
+void LazyDFA::addClosure(unsigned id, StateSet &set)
+{
+    if (Marks[id] == Generation)
+        return;
+    Marks[id] = Generation;
+    Stack.push_back(id);
+    while (!Stack.empty()) {
+        unsigned current = Stack.pop_back_val();
+        set.push_back(current);
+        for (unsigned target : NFAStates[current].EpsilonTargets) {
+            if (Marks[target] == Generation)
+                continue;
+            Marks[target] = Generation;
+            Stack.push_back(target);
+        }
+    }
+}
+
+void LazyDFA::beginClosure()
+{
+    if (++Generation == 0) {
+        // the counter wrapped around, so old marks may look like the current ones
+        std::fill(Marks.begin(), Marks.end(), 0);
+        Generation = 1;
+    }
+    NextSet.clear();
+}
+
+void LazyDFA::step(const StateSet &set, unsigned char symbol)
+{
+    beginClosure();
+    for (unsigned id : set)
+        for (const NFAEdge &edge : NFAStates[id].Edges)
+            if (edge.Lo <= symbol && symbol <= edge.Hi)
+                addClosure(edge.Target, NextSet);
+    llvm::sort(NextSet);
+}
+
+unsigned LazyDFA::findAccepted(const StateSet &set) const
+{
+    for (unsigned id : set)
+        if (NFAStates[id].Kind)
+            return id;
+    return UnknownState;
+}
+
+unsigned LazyDFA::addState()
+{
+    auto iter = StateIDs.find(NextSet);
+    if (iter != StateIDs.end())
+        return iter->second;
+
+    size_t cost = sizeof(DFAState) + NumClasses * sizeof(unsigned)
+                  + NextSet.size() * sizeof(unsigned) + sizeof(StateSet) + MapNodeOverhead;
+    if (cost > CacheBudget)
+        return UnknownState;
+    if (CacheSize + cost > CacheBudget) {
+        bool isThrashing = BytesSinceFlush < (uint64_t)MinBytesPerState * States.size();
+        flush();
+        if (isThrashing)
+            return UnknownState;
+    }
+
+    unsigned id = States.size();
+    iter = StateIDs.emplace(NextSet, id).first;
+    unsigned acceptedID = findAccepted(NextSet);
+    if (acceptedID == UnknownState)
+        States.push_back({&iter->first, 0, KeepMode});
+    else
+        States.push_back(
+            {&iter->first, NFAStates[acceptedID].Kind, NFAStates[acceptedID].NextMode});
+    Transitions.resize(Transitions.size() + NumClasses, UnknownState);
+    CacheSize += cost;
+    return id;
+}
+
+unsigned LazyDFA::getStartState(unsigned mode)
+{
+    if (ModeStarts[mode] != UnknownState)
+        return ModeStarts[mode];
+
+    beginClosure();
+    addClosure(NFAModeStarts[mode], NextSet);
+    llvm::sort(NextSet);
+    unsigned id = addState();
+    ModeStarts[mode] = id;
+    return id;
+}
+
+unsigned LazyDFA::addTransition(unsigned id, unsigned char symbol)
+{
+    step(*States[id].Set, symbol);
+    unsigned cell = id * NumClasses + ByteClasses[symbol];
+    if (NextSet.empty()) {
+        Transitions[cell] = DeadState;
+        return DeadState;
+    }
+
+    uint64_t numFlushes = NumFlushes;
+    unsigned nextID = addState();
+    // after a flush the source state doesn't exist anymore
+    if (nextID != UnknownState && NumFlushes == numFlushes)
+        Transitions[cell] = nextID;
+    return nextID;
+}
+
+const char *LazyDFA::simulateNFA(const char *ptr, Match &match, bool isAfterNull)
+{
+    StateSet set;
+    while (!NextSet.empty()) {
+        set.swap(NextSet);
+        unsigned acceptedID = findAccepted(set);
+        if (acceptedID != UnknownState)
+            match = {ptr, NFAStates[acceptedID].Kind, NFAStates[acceptedID].NextMode};
+        if (isAfterNull)
+            break;
+        char symbol = *ptr++;
+        step(set, symbol);
+        ++NumNFASteps;
+        isAfterNull = symbol == '\0';
+    }
+    return ptr;
+}
+
+const char *LazyDFA::matchLongestToken(const char *ptr, unsigned &kind, unsigned &mode)
+{
+    assert(!NFAStates.empty() && "the NFA must be read before lexing");
+    assert(mode < NFAModeStarts.size() && "unknown mode");
+
+    Match match = {ptr, 0, KeepMode};
+    const char *current = ptr;
+    unsigned id = getStartState(mode);
+    if (id == UnknownState)
+        current = simulateNFA(current, match, false);
+
+    while (id != UnknownState) {
+        unsigned char symbol = *current++;
+        unsigned nextID = Transitions[id * NumClasses + ByteClasses[symbol]];
+        if (nextID == UnknownState) {
+            nextID = addTransition(id, symbol);
+            if (nextID == UnknownState) {
+                current = simulateNFA(current, match, symbol == '\0');
+                break;
+            }
+        }
+        if (nextID == DeadState)
+            break;
+        id = nextID;
+        const DFAState &state = States[id];
+        if (state.Kind)
+            match = {current, state.Kind, state.NextMode};
+        // the null terminates the buffer, so the byte after it isn't read
+        if (symbol == '\0')
+            break;
+    }
+
+    BytesSinceFlush += current - ptr;
+    kind = match.Kind;
+    if (match.NextMode != KeepMode)
+        mode = match.NextMode;
+    return match.End;
+}
+
+} // namespace dzieja
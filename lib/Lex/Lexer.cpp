@@ -1,25 +1,39 @@
 #include "dzieja/Lex/Lexer.h"
 
 #include "dzieja/Basic/TokenKinds.h"
+#include "dzieja/Lex/BasicLexer.h"
+#include "dzieja/Lex/LexDFA.h"
+#include "dzieja/Lex/LexGrammar.h"
 #include "dzieja/Lex/Token.h"
 
 #include <llvm/ADT/StringRef.h>
 #include <llvm/ADT/StringSwitch.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/WithColor.h>
+#include <llvm/Support/raw_ostream.h>
 
-// these two headers are needed for LexDFAImpl.inc
 #include <cassert>
 #include <cstdint>
+#include <memory>
+
+#ifdef DZIEJA_LEX_PROFILE
+#include <cstdlib>
+#endif
 
 using namespace llvm;
 
 namespace dzieja {
 
-Lexer::Lexer(const char *bufferStart, const char *bufferPtr, const char *bufferEnd)
-    : BufferStart(bufferStart), BufferEnd(bufferEnd), BufferPtr(bufferPtr)
+static_assert(DFA_NumModes == (tok::NUM_MODES == 0 ? 1 : tok::NUM_MODES),
+              "the DFA is generated for other modes than TokenKinds.def has");
+
+Lexer::Lexer(const char *bufferStart, const char *bufferPtr, const char *bufferEnd,
+             bool requiresNullTerminator)
+    : BufferStart(bufferStart), BufferEnd(bufferEnd), BufferPtr(bufferPtr),
+      RequiresNullTerminator(requiresNullTerminator)
 {
-    assert(BufferEnd[0] == '\0' && "expected null at the end of the buffer");
+    assert((!RequiresNullTerminator || BufferEnd[0] == '\0')
+           && "expected null at the end of the buffer");
 
     // Check whether we have a UTF-8 BOM in the beginning of the buffer
     if (BufferStart == BufferPtr) {
@@ -34,8 +48,29 @@ Lexer::Lexer(const MemoryBuffer *inputFile)
 {
 }
 
+Lexer::~Lexer() = default;
+
+void Lexer::enableLinearTimeMode()
+{
+    assert(RequiresNullTerminator && "the linear-time mode needs the null terminator");
+
+    // the lexer never goes back, so the memo covers the rest of the buffer only
+    Memo = std::make_unique<MaximalMunchMemo>(BufferPtr, BufferEnd, DFA_InvalidStateID);
+}
+
+void Lexer::disableLinearTimeMode()
+{
+    Memo.reset();
+}
+
 void Lexer::lex(Token &result)
 {
+    if (Grammar) {
+        assert(RequiresNullTerminator && "other grammars need the null terminator");
+        lexWithGrammar(result);
+        return;
+    }
+
     if (inCommentRetentionMode()) {
         do {
             lexInternal(result);
@@ -48,32 +83,172 @@ void Lexer::lex(Token &result)
     }
 }
 
-// This file is an implementation of DFA for lexer. It is consist of functions
-// DFA_delta(stateID, symbol) and DFA_getKind(stateID), and a constant DFA_InvalidStateID.
-// This file is generated with the dzieja-lexgen util from the dzieja/Basic/TokenKinds.def source.
-#include "dzieja/Basic/LexDFAImpl.inc"
+void detail::reportUnexpectedSymbol(const char *ptr)
+{
+    auto &err = WithColor::error() << "unexpected symbol '";
+    err.write_escaped(StringRef(ptr, 1), true) << "'\n";
+    std::exit(1);
+}
+
+#ifdef DZIEJA_LEX_PROFILE
+namespace {
+
+/// Counters of the profiling build (the \c DZIEJA_LEX_PROFILE CMake option). They are shared by
+/// all the lexers of the process and aren't thread-safe.
+///
+/// At exit the profile is written to the file specified with \c DZIEJA_LEX_PROFILE_FILE environment
+/// variable, or to \c dzieja-lex.profile in the working directory. States are written with their
+/// canonical IDs, so \c dzieja-lexgen -profile-use understands the profile regardless of how the
+/// states of this build are numbered.
+struct LexProfile {
+    uint64_t Transitions[DFA_InvalidStateID][256] = {};
+    uint64_t Kinds[tok::NUM_TOKENS] = {};
+
+    ~LexProfile();
+};
+
+LexProfile::~LexProfile()
+{
+    const char *filename = std::getenv("DZIEJA_LEX_PROFILE_FILE");
+    std::error_code EC;
+    raw_fd_ostream out(filename ? filename : "dzieja-lex.profile", EC);
+    if (EC)
+        return;
+
+    // the profile is written in order of canonical IDs, so it doesn't depend on the layout too
+    unsigned canonicalToID[DFA_InvalidStateID];
+    for (unsigned id = 0; id < DFA_InvalidStateID; id++)
+        canonicalToID[DFA_getCanonicalStateID(id)] = id;
+
+    out << "dzieja-lex-profile 2 " << (unsigned)DFA_InvalidStateID << " " << (unsigned)DFA_Hash
+        << "\n";
+    for (unsigned canonicalID = 0; canonicalID < DFA_InvalidStateID; canonicalID++) {
+        uint64_t visits = 0;
+        for (uint64_t count : Transitions[canonicalToID[canonicalID]])
+            visits += count;
+        out << "state " << canonicalID << " " << visits << "\n";
+    }
+    for (unsigned canonicalID = 0; canonicalID < DFA_InvalidStateID; canonicalID++) {
+        const uint64_t *row = Transitions[canonicalToID[canonicalID]];
+        for (unsigned symbol = 0; symbol < 256; symbol++)
+            if (row[symbol])
+                out << "transition " << canonicalID << " " << symbol << " " << row[symbol] << "\n";
+    }
+    for (unsigned kind = 0; kind < tok::NUM_TOKENS; kind++)
+        if (Kinds[kind])
+            out << "kind " << tok::getTokenName((tok::TokenKind)kind) << " " << Kinds[kind] << "\n";
+}
+
+LexProfile Profile;
+
+} // namespace
+#endif
+
+static inline void profileTransition(unsigned stateID, char symbol)
+{
+#ifdef DZIEJA_LEX_PROFILE
+    ++Profile.Transitions[stateID][(unsigned char)symbol];
+#endif
+}
+
+static inline void profileToken(tok::TokenKind kind)
+{
+#ifdef DZIEJA_LEX_PROFILE
+    ++Profile.Kinds[kind];
+#endif
+}
 
 void Lexer::lexInternal(Token &result)
 {
-    unsigned prevID = DFA_StartStateID;
-    unsigned stateID = DFA_StartStateID;
+    if (Memo) {
+        lexInternalLinear(result);
+        return;
+    }
+    if (!RequiresNullTerminator) {
+        lexInternalInRange(result);
+        return;
+    }
+
+    // Transitions into accepting states are marked with DFA_AcceptFlag, so the last accept point
+    // is tracked with conditional moves instead of a branch or a kind lookup per byte. When the
+    // DFA stops, the lexer backtracks to the end of the longest accepted token. The DFA stops on
+    // the null too, so it never reads after the terminator.
+    unsigned stateID = DFA_getStartStateID(Mode);
+    unsigned acceptID = stateID;
     const char *tokStartPtr = BufferPtr;
+    const char *acceptPtr = BufferPtr;
+    const char *ptr = BufferPtr;
+    char symbol;
 
     do {
-        prevID = stateID;
-        stateID = DFA_delta(stateID, *BufferPtr++);
-    } while (stateID != DFA_InvalidStateID);
-    --BufferPtr;
-
-    if (DFA_getKind(prevID) == tok::unknown) {
-        auto &err = WithColor::error() << "unexpected symbol '";
-        err.write_escaped(StringRef(BufferPtr, 1), true) << "'\n";
-        std::exit(1);
-    }
+        symbol = *ptr++;
+        profileTransition(stateID & (DFA_AcceptFlag - 1u), symbol);
+        stateID = DFA_delta(stateID, symbol);
+        bool isAccepting = stateID & DFA_AcceptFlag;
+        acceptPtr = isAccepting ? ptr : acceptPtr;
+        acceptID = isAccepting ? stateID : acceptID;
+    } while (stateID != DFA_InvalidStateID && symbol != '\0');
+
+    if (acceptPtr == tokStartPtr)
+        detail::reportUnexpectedSymbol(tokStartPtr);
+
+    // the DFA makes one transition per symbol it reads
+    TokenSteps = ptr - tokStartPtr;
+    NumSteps += TokenSteps;
+    BufferPtr = acceptPtr;
+    Mode = DFA_getNextMode(acceptID, Mode);
+    result.setBufferPtr(tokStartPtr);
+    result.setLength(acceptPtr - tokStartPtr);
+    result.setKind((tok::TokenKind)DFA_getKind(acceptID));
+    profileToken(result.getKind());
+}
 
+void Lexer::lexInternalLinear(Token &result)
+{
+    const char *tokStartPtr = BufferPtr;
+    unsigned kind;
+    BufferPtr = matchLongestTokenLinear<LexDFA>(tokStartPtr, kind, Mode, *Memo, &TokenSteps);
+    if (BufferPtr == tokStartPtr)
+        detail::reportUnexpectedSymbol(tokStartPtr);
+    NumSteps += TokenSteps;
     result.setBufferPtr(tokStartPtr);
     result.setLength(BufferPtr - tokStartPtr);
-    result.setKind((tok::TokenKind)DFA_getKind(prevID));
+    result.setKind((tok::TokenKind)kind);
+    profileToken(result.getKind());
+}
+
+void Lexer::lexInternalInRange(Token &result)
+{
+    const char *tokStartPtr = BufferPtr;
+    unsigned kind;
+    const char *tokEndPtr =
+        matchLongestTokenInRange<LexDFA>(tokStartPtr, BufferEnd, kind, Mode, &TokenSteps);
+    if (!tokEndPtr) {
+        // the end of the range isn't readable, so it is reported as the null the DFA stepped on
+        detail::reportUnexpectedSymbol(tokStartPtr != BufferEnd ? tokStartPtr : "");
+    }
+    NumSteps += TokenSteps;
+    BufferPtr = tokEndPtr;
+    result.setBufferPtr(tokStartPtr);
+    result.setLength(tokEndPtr - tokStartPtr);
+    result.setKind((tok::TokenKind)kind);
+    profileToken(result.getKind());
+}
+
+void Lexer::lexWithGrammar(Token &result)
+{
+    unsigned short skippedCommentKind = inCommentRetentionMode() ? 0 : Grammar->CommentKind;
+    unsigned kind;
+    TokenSteps = 0;
+    do {
+        const char *tokStartPtr = BufferPtr;
+        BufferPtr = Grammar->MatchToken(tokStartPtr, kind, Mode);
+        if (BufferPtr == tokStartPtr)
+            detail::reportUnexpectedSymbol(tokStartPtr);
+        result.setBufferPtr(tokStartPtr);
+        result.setLength(BufferPtr - tokStartPtr);
+    } while (kind == Grammar->GapKind || kind == skippedCommentKind);
+    result.setKind((tok::TokenKind)kind);
 }
 
 } // namespace dzieja
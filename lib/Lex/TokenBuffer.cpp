@@ -0,0 +1,51 @@
+#include "dzieja/Lex/TokenBuffer.h"
+
+#include "dzieja/Lex/Lexer.h"
+#include "dzieja/Lex/Token.h"
+
+#include <llvm/Support/ErrorHandling.h>
+
+#include <limits>
+
+using namespace llvm;
+
+namespace dzieja {
+
+void TokenBuffer::push_back(const Token &token)
+{
+    assert(BufferStart <= token.getBufferPtr() && "token must be inside the buffer");
+    size_t offset = token.getBufferPtr() - BufferStart;
+    // the offset would be truncated silently, so it is checked in release builds too
+    if (offset > std::numeric_limits<uint32_t>::max())
+        report_fatal_error("TokenBuffer supports buffers up to 4 GiB only");
+
+    unsigned length = token.getLength();
+    if (length < PackedToken::LongLength) {
+        Tokens.push_back(PackedToken(offset, length, token.getKind()));
+    }
+    else {
+        LongLengths[Tokens.size()] = length;
+        Tokens.push_back(PackedToken(offset, PackedToken::LongLength, token.getKind()));
+    }
+}
+
+void TokenBuffer::lexAll(Lexer &lexer)
+{
+    // the eof token is at the end of the buffer, so a too big buffer is rejected before lexing
+    if ((size_t)(lexer.getBufferEnd() - BufferStart) > std::numeric_limits<uint32_t>::max())
+        report_fatal_error("TokenBuffer supports buffers up to 4 GiB only");
+
+    Token token;
+    do {
+        lexer.lex(token);
+        push_back(token);
+    } while (!token.is(tok::eof));
+}
+
+void TokenBuffer::clear()
+{
+    Tokens.clear();
+    LongLengths.clear();
+}
+
+} // namespace dzieja
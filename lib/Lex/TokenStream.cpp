@@ -0,0 +1,32 @@
+#include "dzieja/Lex/TokenStream.h"
+
+#include "dzieja/Lex/Lexer.h"
+
+#include <llvm/Support/ErrorHandling.h>
+
+using namespace llvm;
+
+namespace dzieja {
+
+void TokenStream::fill(size_t pos)
+{
+    if (ReachedEOF)
+        return;
+
+    // a token out of the capacity would overwrite a still needed one, and the wrong token would be
+    // returned silently, so it is checked in release builds too
+    size_t oldest = NumMarks ? Anchor : Head;
+    if (pos - oldest >= Capacity)
+        report_fatal_error("TokenStream lookahead is out of the ring buffer capacity");
+
+    for (size_t end = oldest + Capacity; Tail < end;) {
+        Token &token = Ring[Tail++ & Mask];
+        Lex.lex(token);
+        if (token.is(tok::eof)) {
+            ReachedEOF = true;
+            break;
+        }
+    }
+}
+
+} // namespace dzieja
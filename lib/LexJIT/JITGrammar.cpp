@@ -0,0 +1,262 @@
+#include "dzieja/LexJIT/JITGrammar.h"
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils.h>
+
+#include <cassert>
+#include <vector>
+
+using namespace llvm;
+
+namespace dzieja {
+
+static const char *const MatchFunctionName = "dzieja_jit_match";
+
+bool JITDFA::read(StringRef text, std::string &error)
+{
+    // The format of NFA::write of dzieja-lexgen:
+    //   automaton <number of states> <start state ID> <is DFA>
+    //   <kind> <number of edges> [<lo> <hi> <target>]...   -- one line for every state
+    //   modes <number of modes> <start state ID>...   -- only for a DFA with several modes
+    //   next-modes <next mode>...   -- one number for every state, only if modes are switched
+    auto readNumber = [&text](unsigned &number) {
+        text = text.ltrim();
+        return !text.consumeInteger(10, number);
+    };
+    auto fail = [&error](const char *message) {
+        error = message;
+        return false;
+    };
+
+    States.clear();
+    ModeStartStates.clear();
+    text = text.ltrim();
+    unsigned numStates, startID, isDFA;
+    if (!text.consume_front("automaton") || !readNumber(numStates) || !readNumber(startID)
+        || !readNumber(isDFA) || numStates == 0 || startID >= numStates)
+        return fail("malformed header of the automaton");
+    if (!isDFA)
+        return fail("the automaton is not a DFA");
+
+    States.resize(numStates);
+    BitVector symbols(256);
+    for (State &state : States) {
+        unsigned kind, numEdges;
+        if (!readNumber(kind) || !readNumber(numEdges) || kind > UINT16_MAX)
+            return fail("malformed state of the automaton");
+        state.Kind = kind;
+        symbols.reset();
+        for (unsigned i = 0; i < numEdges; i++) {
+            unsigned lo, hi, target;
+            if (!readNumber(lo) || !readNumber(hi) || !readNumber(target) || lo > hi || hi > 255
+                || target >= numStates)
+                return fail("malformed edge of the automaton");
+            if (symbols.find_first_in(lo, hi + 1) != -1)
+                return fail("the automaton is not a DFA");
+            symbols.set(lo, hi + 1);
+            state.Edges.push_back({(uint8_t)lo, (uint8_t)hi, target});
+        }
+    }
+
+    ModeStartStates.push_back(startID);
+    text = text.ltrim();
+    if (text.consume_front("modes ")) {
+        unsigned numModes;
+        if (!readNumber(numModes) || numModes < 2)
+            return fail("malformed modes of the automaton");
+        ModeStartStates.clear();
+        for (unsigned mode = 0; mode < numModes; mode++) {
+            unsigned id;
+            if (!readNumber(id) || id >= numStates)
+                return fail("malformed modes of the automaton");
+            ModeStartStates.push_back(id);
+        }
+    }
+    text = text.ltrim();
+    if (text.consume_front("next-modes ")) {
+        for (State &state : States) {
+            unsigned mode;
+            if (!readNumber(mode) || mode >= ModeStartStates.size())
+                return fail("malformed modes of the automaton");
+            state.NextMode = state.Kind ? mode : KeepMode;
+        }
+    }
+    return true;
+}
+
+/// Emits the matching function of \p dfa into \p module. It has the signature of
+/// \c LexGrammar::MatchFunction, where references are passed as pointers:
+/// \code
+///   const char *match(const char *ptr, unsigned &kind, unsigned &mode)
+/// \endcode
+///
+/// Every state is a basic block that reads a symbol and switches to the block of the next state,
+/// and the blocks of accepting states remember the accepted position first. The null terminates the
+/// buffer, so the null leads to a block that only remembers the accepted position and never reads
+/// after the null. The variables are emitted as allocas and are promoted to registers by \c mem2reg
+/// afterwards.
+static Function *emitMatchFunction(const JITDFA &dfa, Module &module)
+{
+    static_assert(sizeof(unsigned) == 4, "kinds and modes are passed as i32");
+    LLVMContext &ctx = module.getContext();
+    Type *charTy = Type::getInt8Ty(ctx);
+    Type *charPtrTy = Type::getInt8PtrTy(ctx);
+    Type *int32Ty = Type::getInt32Ty(ctx);
+    Type *int32PtrTy = Type::getInt32PtrTy(ctx);
+
+    auto *fnTy = FunctionType::get(charPtrTy, {charPtrTy, int32PtrTy, int32PtrTy}, false);
+    Function *fn = Function::Create(fnTy, Function::ExternalLinkage, MatchFunctionName, module);
+    Argument *ptrArg = fn->getArg(0);
+    Argument *kindArg = fn->getArg(1);
+    Argument *modeArg = fn->getArg(2);
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    SmallVector<BasicBlock *, 0> stateBlocks;
+    for (size_t id = 0; id < dfa.States.size(); id++)
+        stateBlocks.push_back(BasicBlock::Create(ctx, "state" + Twine(id), fn));
+    BasicBlock *done = BasicBlock::Create(ctx, "done", fn);
+
+    IRBuilder<> builder(entry);
+    Value *ptrVar = builder.CreateAlloca(charPtrTy, nullptr, "ptr.addr");
+    Value *acceptPtrVar = builder.CreateAlloca(charPtrTy, nullptr, "accept.ptr.addr");
+    Value *acceptKindVar = builder.CreateAlloca(int32Ty, nullptr, "accept.kind.addr");
+    Value *acceptModeVar = builder.CreateAlloca(int32Ty, nullptr, "accept.mode.addr");
+    Value *mode = builder.CreateLoad(int32Ty, modeArg, "mode");
+    builder.CreateStore(ptrArg, ptrVar);
+    builder.CreateStore(ptrArg, acceptPtrVar);
+    builder.CreateStore(builder.getInt32(0), acceptKindVar);
+    builder.CreateStore(mode, acceptModeVar);
+    if (dfa.ModeStartStates.size() == 1) {
+        builder.CreateBr(stateBlocks[dfa.ModeStartStates[0]]);
+    }
+    else {
+        SwitchInst *modeSwitch = builder.CreateSwitch(mode, stateBlocks[dfa.ModeStartStates[0]],
+                                                      dfa.ModeStartStates.size());
+        for (size_t i = 0; i < dfa.ModeStartStates.size(); i++)
+            modeSwitch->addCase(builder.getInt32(i), stateBlocks[dfa.ModeStartStates[i]]);
+    }
+
+    auto emitAccept = [&](const JITDFA::State &state, Value *ptr) {
+        builder.CreateStore(ptr, acceptPtrVar);
+        builder.CreateStore(builder.getInt32(state.Kind), acceptKindVar);
+        // a shorter token accepted before may have switched the mode
+        Value *nextMode = state.NextMode == JITDFA::KeepMode
+                              ? mode
+                              : (Value *)builder.getInt32(state.NextMode);
+        builder.CreateStore(nextMode, acceptModeVar);
+    };
+
+    // blocks of the states reached by the null, created on demand
+    std::vector<BasicBlock *> nullBlocks(dfa.States.size(), nullptr);
+    for (size_t id = 0; id < dfa.States.size(); id++) {
+        const JITDFA::State &state = dfa.States[id];
+        builder.SetInsertPoint(stateBlocks[id]);
+        Value *ptr = builder.CreateLoad(charPtrTy, ptrVar, "ptr");
+        if (state.Kind)
+            emitAccept(state, ptr);
+        if (state.Edges.empty()) {
+            builder.CreateBr(done);
+            continue;
+        }
+
+        Value *symbol = builder.CreateLoad(charTy, ptr, "symbol");
+        builder.CreateStore(builder.CreateConstInBoundsGEP1_64(charTy, ptr, 1, "next"), ptrVar);
+        SwitchInst *symbolSwitch = builder.CreateSwitch(symbol, done);
+        for (const JITDFA::Edge &edge : state.Edges) {
+            for (unsigned c = edge.Lo; c <= edge.Hi; c++) {
+                BasicBlock *target = stateBlocks[edge.Target];
+                if (c == 0) {
+                    BasicBlock *&nullBlock = nullBlocks[edge.Target];
+                    if (!nullBlock)
+                        nullBlock = BasicBlock::Create(ctx, "state" + Twine(edge.Target) + ".null",
+                                                       fn, done);
+                    target = nullBlock;
+                }
+                symbolSwitch->addCase(builder.getInt8(c), target);
+            }
+        }
+    }
+
+    for (size_t id = 0; id < nullBlocks.size(); id++) {
+        if (!nullBlocks[id])
+            continue;
+        builder.SetInsertPoint(nullBlocks[id]);
+        if (dfa.States[id].Kind)
+            emitAccept(dfa.States[id], builder.CreateLoad(charPtrTy, ptrVar, "ptr"));
+        builder.CreateBr(done);
+    }
+
+    builder.SetInsertPoint(done);
+    builder.CreateStore(builder.CreateLoad(int32Ty, acceptKindVar, "accept.kind"), kindArg);
+    builder.CreateStore(builder.CreateLoad(int32Ty, acceptModeVar, "accept.mode"), modeArg);
+    builder.CreateRet(builder.CreateLoad(charPtrTy, acceptPtrVar, "accept.ptr"));
+    return fn;
+}
+
+JITGrammar::JITGrammar() = default;
+JITGrammar::~JITGrammar() = default;
+
+std::unique_ptr<JITGrammar> JITGrammar::compile(const JITDFA &dfa, unsigned short gapKind,
+                                                unsigned short commentKind, std::string &error)
+{
+    assert(!dfa.ModeStartStates.empty() && "the DFA must have at least one mode");
+
+    if (InitializeNativeTarget() || InitializeNativeTargetAsmPrinter()) {
+        error = "the native target is not available";
+        return nullptr;
+    }
+
+    auto context = std::make_unique<LLVMContext>();
+    auto module = std::make_unique<Module>("dzieja-lex-jit", *context);
+    Function *fn = emitMatchFunction(dfa, *module);
+    raw_string_ostream verifierErrors(error);
+    if (verifyFunction(*fn, &verifierErrors)) {
+        verifierErrors.flush();
+        return nullptr;
+    }
+
+    legacy::FunctionPassManager passes(module.get());
+    passes.add(createPromoteMemoryToRegisterPass());
+    passes.add(createInstructionCombiningPass());
+    passes.add(createCFGSimplificationPass());
+    passes.doInitialization();
+    passes.run(*fn);
+    passes.doFinalization();
+
+    auto jit = orc::LLJITBuilder().create();
+    if (!jit) {
+        error = toString(jit.takeError());
+        return nullptr;
+    }
+    if (Error err = (*jit)->addIRModule(orc::ThreadSafeModule(std::move(module),
+                                                              std::move(context)))) {
+        error = toString(std::move(err));
+        return nullptr;
+    }
+    auto symbol = (*jit)->lookup(MatchFunctionName);
+    if (!symbol) {
+        error = toString(symbol.takeError());
+        return nullptr;
+    }
+
+    std::unique_ptr<JITGrammar> grammar(new JITGrammar);
+    grammar->JIT = std::move(*jit);
+    // the function takes pointers where LexGrammar::MatchFunction takes references, which have
+    // the same representation in all the supported ABIs
+    grammar->Grammar = {(LexGrammar::MatchFunction)symbol->getAddress(), gapKind, commentKind};
+    return grammar;
+}
+
+} // namespace dzieja
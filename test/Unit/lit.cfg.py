@@ -0,0 +1,14 @@
+# -*- Python -*-
+
+# Configuration file for the unit tests: every gtest executable ending with "Tests" in
+# unittests/ of the build directory is a test suite.
+
+import os
+
+import lit.formats
+
+config.name = "Dzieja-Unit"
+config.suffixes = []
+config.test_exec_root = os.path.join(config.dzieja_obj_root, "unittests")
+config.test_source_root = config.test_exec_root
+config.test_format = lit.formats.GoogleTest(".", "Tests")
@@ -0,0 +1,24 @@
+# -*- Python -*-
+
+import os
+
+import lit.formats
+
+from lit.llvm import llvm_config
+
+config.name = "Dzieja"
+config.test_format = lit.formats.ShTest(not llvm_config.use_lit_shell)
+config.suffixes = [".test"]
+
+# the unit tests are a separate suite configured in Unit/
+config.excludes = ["Inputs", "Unit", "CMakeLists.txt"]
+
+config.test_source_root = os.path.dirname(__file__)
+config.test_exec_root = os.path.join(config.dzieja_obj_root, "test")
+
+# FileCheck etc. are run from the LLVM tools
+llvm_config.with_environment("PATH", config.llvm_tools_dir, append_path=True)
+
+llvm_config.use_default_substitutions()
+llvm_config.add_tool_substitutions(["dzieja-lexgen"],
+                                   [config.dzieja_tools_dir, config.llvm_tools_dir])
@@ -0,0 +1,98 @@
+#include "dzieja/Lex/LexGrammar.h"
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/WithColor.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+using namespace llvm;
+using namespace dzieja;
+
+namespace bench {
+
+enum TokenKind : unsigned short {
+#define TOK(name) name,
+#include "Backtracking.def"
+};
+
+#include "BacktrackingDFA.inc"
+
+} // namespace bench
+
+static cl::opt<unsigned> MinLength("min-length", cl::init(1024),
+                                   cl::desc("Length of the shortest run of letters"));
+static cl::opt<unsigned> MaxLength("max-length", cl::init(65536),
+                                   cl::desc("Length of the longest run of letters"));
+static cl::opt<unsigned> Repeat("repeat", cl::init(3), cl::desc("Lex every input N times"));
+
+static const char *Overview =
+    "The program measures the lexer on the worst case of the maximal munch: runs of\n"
+    "          letters 'a' with the tokens 'a' and 'a+b'. Time per byte grows with the\n"
+    "          length for the usual matching, and stays the same for the linear-time one.\n";
+
+/// Lexes \p input \c Repeat times with \p match, which is called as \c matchLongestToken, and
+/// returns nanoseconds per byte. The kinds and the lengths of the tokens are hashed into
+/// \p checksum, so the results of different matchers can be compared.
+template<typename MatchFunction>
+static double measure(const std::string &input, MatchFunction match, uint64_t &checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < Repeat; ++i) {
+        checksum = 0;
+        const char *ptr = input.c_str();
+        unsigned kind = bench::unknown, mode = 0;
+        while (kind != bench::eof) {
+            const char *end = match(ptr, kind, mode);
+            if (end == ptr) {
+                WithColor::error(llvm::errs(), "dzieja-lex-bench") << "unexpected symbol\n";
+                std::exit(1);
+            }
+            checksum = checksum * 31 + kind * 65599 + (end - ptr);
+            ptr = end;
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ((double)Repeat * (input.size() + 1));
+}
+
+int main(int argc, char *argv[])
+{
+    cl::ParseCommandLineOptions(argc, argv, Overview);
+    if (Repeat == 0 || MinLength == 0) {
+        WithColor::error(llvm::errs(), "dzieja-lex-bench")
+            << "-repeat and -min-length must be positive\n";
+        return 1;
+    }
+
+    raw_ostream &os = llvm::outs();
+    os << "    length  backtracking, ns/byte  linear-time, ns/byte\n";
+    for (uint64_t length = MinLength; length <= MaxLength; length *= 2) {
+        std::string input(length, 'a');
+
+        uint64_t backtrackingChecksum = 0, linearChecksum = 0;
+        double backtracking = measure(input, matchLongestToken<bench::BenchLexDFA>,
+                                      backtrackingChecksum);
+        double linear = measure(
+            input,
+            [&input](const char *ptr, unsigned &kind, unsigned &mode) {
+                // the memo is reset at the start of every run, so its setup is measured too
+                static MaximalMunchMemo memo;
+                if (ptr == input.c_str())
+                    memo.reset(ptr, ptr + input.size(), bench::BenchLexDFA::InvalidStateID);
+                return matchLongestTokenLinear<bench::BenchLexDFA>(ptr, kind, mode, memo);
+            },
+            linearChecksum);
+
+        os << format("%10llu %22.2f %21.2f\n", (unsigned long long)length, backtracking, linear);
+        if (backtrackingChecksum != linearChecksum) {
+            WithColor::error(llvm::errs(), "dzieja-lex-bench")
+                << "tokens of the linear-time matching differ\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace dzieja {
+
+#ifdef __linux__
+
+static int openEvent(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1, /*group_fd=*/-1, 0);
+}
+
+PerfCounters::PerfCounters()
+{
+    FDs[Cycles] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    FDs[Instructions] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    FDs[BranchMisses] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    FDs[L1DMisses] = openEvent(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    if (!hasAvailable())
+        Error = std::string("perf_event_open failed: ") + std::strerror(errno);
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd : FDs) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void PerfCounters::start()
+{
+    for (int fd : FDs) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop()
+{
+    for (int fd : FDs) {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (unsigned i = 0; i < NumEvents; ++i) {
+        // value, time enabled, time running
+        uint64_t data[3];
+        Values[i] = 0;
+        if (FDs[i] < 0 || read(FDs[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+            continue;
+        Values[i] = data[2] == data[1] ? data[0] : (uint64_t)((double)data[0] * data[1] / data[2]);
+    }
+}
+
+#else
+
+PerfCounters::PerfCounters() : Error("hardware counters are supported only on Linux")
+{
+    for (int &fd : FDs)
+        fd = -1;
+}
+
+PerfCounters::~PerfCounters() {}
+
+void PerfCounters::start() {}
+
+void PerfCounters::stop() {}
+
+#endif
+
+bool PerfCounters::hasAvailable() const
+{
+    for (unsigned i = 0; i < NumEvents; ++i) {
+        if (isAvailable((Event)i))
+            return true;
+    }
+    return false;
+}
+
+const char *PerfCounters::getEventName(Event event)
+{
+    switch (event) {
+    case Cycles:
+        return "cycles";
+    case Instructions:
+        return "instructions";
+    case BranchMisses:
+        return "branch-misses";
+    case L1DMisses:
+        return "L1-dcache-load-misses";
+    case NumEvents:
+        break;
+    }
+    return "unknown";
+}
+
+} // namespace dzieja
@@ -0,0 +1,56 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// This file contains the declaration of \c PerfCounters — a set of hardware performance counters
+/// used to measure the lexer's hot loop.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_TOOLS_DZIEJA_LEXER_PERFCOUNTERS_H
+#define DZIEJA_TOOLS_DZIEJA_LEXER_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+namespace dzieja {
+
+/// Hardware counters of the current thread, counted in user space only.
+///
+/// On Linux they are opened via \c perf_event_open. On other systems, or if the kernel doesn't
+/// allow to open them (e.g. because of \c perf_event_paranoid), the counters are unavailable, and
+/// \c getError says why.
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, BranchMisses, L1DMisses, NumEvents };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    /// Resets and starts all the available counters.
+    void start();
+
+    /// Stops the counters and reads their values.
+    void stop();
+
+    bool isAvailable(Event event) const { return FDs[event] >= 0; }
+    bool hasAvailable() const;
+
+    /// Returns value of the counter, scaled if the kernel multiplexed it with other counters.
+    uint64_t getValue(Event event) const { return Values[event]; }
+
+    const std::string &getError() const { return Error; }
+
+    static const char *getEventName(Event event);
+
+private:
+    int FDs[NumEvents];
+    uint64_t Values[NumEvents] = {};
+    std::string Error;
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_TOOLS_DZIEJA_LEXER_PERFCOUNTERS_H
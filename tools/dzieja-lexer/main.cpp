@@ -1,12 +1,22 @@
+#include "PerfCounters.h"
+
 #include "dzieja/Basic/TokenKinds.h"
+#include "dzieja/Lex/BasicLexer.h"
+#include "dzieja/Lex/LazyDFA.h"
 #include "dzieja/Lex/Lexer.h"
 #include "dzieja/Lex/Token.h"
+#include "dzieja/Lex/TokenBuffer.h"
+#include "dzieja/Lex/TokenStream.h"
+#include "dzieja/LexJIT/JITGrammar.h"
 
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/WithColor.h>
 
+#include <memory>
 #include <string>
+#include <vector>
 
 using namespace llvm;
 using namespace dzieja;
@@ -18,6 +28,198 @@ static cl::opt<bool>
     PrintTokenSpelling("print-tok-spell", cl::init(false),
                        cl::desc("Print tokens' spellings separated with new line"));
 static cl::opt<int> Repeat("repeat", cl::init(1), cl::desc("Repeat lexing of a file N times"));
+static cl::opt<bool>
+    UseTokenBuffer("use-token-buffer", cl::init(false),
+                   cl::desc("Lex the whole file into a buffer of packed tokens before printing"));
+static cl::opt<bool> UseTokenStream("use-token-stream", cl::init(false),
+                                    cl::desc("Read tokens via the lookahead token stream"));
+static cl::opt<bool>
+    UseBasicLexer("use-basic-lexer", cl::init(false),
+                  cl::desc("Lex with the lexer specialized at compile time instead of Lexer"));
+static cl::opt<bool>
+    UsePerfCounters("perf-counters", cl::init(false),
+                    cl::desc("Measure the lexing loop with hardware performance counters and "
+                             "print statistics per byte and per token instead of tokens"));
+
+static cl::opt<bool>
+    LinearTime("linear-time", cl::init(false),
+               cl::desc("Lex in the linear-time mode, which doesn't rescan bytes after\n"
+                        "backtracking to the longest token"));
+
+static cl::opt<bool>
+    NoNullTerminator("no-null-terminator", cl::init(false),
+                     cl::desc("Lex the file as a range without relying on the null after it.\n"
+                              "The eof token is empty then"));
+
+static cl::opt<std::string>
+    JITDFAFile("jit-dfa", cl::init(""), cl::value_desc("filename"),
+               cl::desc("Compile the DFA written by dzieja-lexgen -emit-dfa at runtime and lex\n"
+                        "with it instead of the built-in DFA. The DFA must be generated from\n"
+                        "TokenKinds.def the tool is built with."));
+
+static cl::opt<std::string>
+    LazyNFAFile("lazy-nfa", cl::init(""), cl::value_desc("filename"),
+                cl::desc("Lex with the lazy DFA built on demand from the NFA written by\n"
+                         "dzieja-lexgen -emit-nfa. The NFA must be generated from\n"
+                         "TokenKinds.def the tool is built with."));
+static cl::opt<unsigned>
+    LazyDFACacheSize("lazy-dfa-cache", cl::init(LazyDFA::DefaultCacheBudget),
+                     cl::value_desc("bytes"), cl::desc("Memory budget of the lazy DFA's cache"));
+
+/// Grammar compiled from \c JITDFAFile or built from \c LazyNFAFile, or null for the built-in DFA.
+static const LexGrammar *Grammar = nullptr;
+
+/// DFA of \c LazyNFAFile. A matching function of \c LexGrammar has no context, so the grammar
+/// calls \c matchLazyDFA, which forwards to it.
+static std::unique_ptr<LazyDFA> TheLazyDFA;
+
+static const char *matchLazyDFA(const char *ptr, unsigned &kind, unsigned &mode)
+{
+    return TheLazyDFA->matchLongestToken(ptr, kind, mode);
+}
+
+/// Settings of the tool's lexer: comments are retained.
+struct ToolLexerPolicy : DefaultLexerPolicy {
+    static constexpr bool RetainComments = true;
+};
+
+/// Settings of the tool's lexer with \c -no-null-terminator.
+struct ToolRangeLexerPolicy : ToolLexerPolicy {
+    static constexpr bool RequiresNullTerminator = false;
+};
+
+/// Makes the lexer of \p buffer with the settings of the command line.
+static std::unique_ptr<Lexer> createLexer(const MemoryBuffer &buffer)
+{
+    auto L = std::make_unique<Lexer>(buffer.getBufferStart(), buffer.getBufferStart(),
+                                     buffer.getBufferEnd(), !NoNullTerminator);
+    L->setGrammar(Grammar);
+    L->enableCommentRetentionMode();
+    if (LinearTime)
+        L->enableLinearTimeMode();
+    return L;
+}
+
+template<typename TokenT>
+static void printToken(const TokenT &T)
+{
+    if (PrintTokenName) {
+        llvm::outs() << T.getName();
+        if (PrintTokenSpelling)
+            llvm::outs() << ": ";
+        else
+            llvm::outs() << "\n";
+    }
+    if (PrintTokenSpelling)
+        llvm::outs() << T.getSpelling() << "\n";
+}
+
+/// Lexes \p buffer with \c BasicLexer configured by \p Policy and prints the tokens.
+template<typename Policy>
+static void lexWithBasicLexer(const MemoryBuffer &buffer)
+{
+    BasicLexer<LexDFA, Policy> L(&buffer);
+    Token T;
+    do {
+        L.lex(T);
+        printToken(T);
+    } while (!T.is(dzieja::tok::eof));
+}
+
+/// Prints number of tokens, bytes and DFA transitions of every token kind. Trivia skipped by the
+/// lexer are counted separately as the bytes between tokens and the transitions made for them.
+/// Transitions are counted by the built-in DFA only, so they are n/a for -jit-dfa and -lazy-nfa.
+static void printSoftwareStatistics(const MemoryBuffer &buffer)
+{
+    std::vector<uint64_t> numTokens(tok::NUM_TOKENS), numBytes(tok::NUM_TOKENS),
+        numSteps(tok::NUM_TOKENS);
+    uint64_t numSkippedBytes = 0, numSkippedSteps = 0;
+
+    auto L = createLexer(buffer);
+    const char *prevEnd = L->getBufferStart();
+    Token T;
+    do {
+        uint64_t prevNumSteps = L->getNumSteps();
+        L->lex(T);
+        numSkippedBytes += T.getBufferPtr() - prevEnd;
+        numSkippedSteps += L->getNumSteps() - prevNumSteps - L->getTokenSteps();
+        prevEnd = T.getBufferPtr() + T.getLength();
+        ++numTokens[T.getKind()];
+        numBytes[T.getKind()] += T.getLength();
+        numSteps[T.getKind()] += L->getTokenSteps();
+    } while (!T.is(tok::eof));
+
+    raw_ostream &os = llvm::outs();
+    bool hasSteps = !Grammar;
+    os << "kind                 tokens        bytes  bytes/token  steps/token\n";
+    for (unsigned kind = 0; kind < tok::NUM_TOKENS; ++kind) {
+        if (!numTokens[kind])
+            continue;
+        os << format("%-16s %10llu %12llu %12.2f", tok::getTokenName((tok::TokenKind)kind),
+                     (unsigned long long)numTokens[kind], (unsigned long long)numBytes[kind],
+                     (double)numBytes[kind] / numTokens[kind]);
+        if (hasSteps)
+            os << format(" %12.2f\n", (double)numSteps[kind] / numTokens[kind]);
+        else
+            os << "          n/a\n";
+    }
+    os << "<skipped>" << format("%32llu", (unsigned long long)numSkippedBytes);
+    if (hasSteps)
+        os << format("%26llu steps\n", (unsigned long long)numSkippedSteps);
+    else
+        os << "\n";
+}
+
+/// Lexes the buffer \c Repeat times with the hardware counters enabled, and prints the counters
+/// per byte and per token together with the software statistics.
+static void measureLexer(const MemoryBuffer &buffer)
+{
+    PerfCounters counters;
+    uint64_t numTokens = 0;
+
+    counters.start();
+    for (int i = 0; i < Repeat; ++i) {
+        auto L = createLexer(buffer);
+        Token T;
+        do {
+            L->lex(T);
+            ++numTokens;
+        } while (!T.is(tok::eof));
+    }
+    counters.stop();
+
+    raw_ostream &os = llvm::outs();
+    uint64_t numBytes = (uint64_t)buffer.getBufferSize() * Repeat;
+    os << "Lexed " << numBytes << " bytes into " << numTokens << " tokens (" << Repeat
+       << " runs)\n\n";
+
+    if (counters.hasAvailable()) {
+        os << "counter                             total     per byte    per token\n";
+        for (unsigned i = 0; i < PerfCounters::NumEvents; ++i) {
+            auto event = (PerfCounters::Event)i;
+            if (!counters.isAvailable(event)) {
+                os << left_justify(PerfCounters::getEventName(event), 24) << "              n/a\n";
+                continue;
+            }
+            uint64_t value = counters.getValue(event);
+            os << format("%-24s %16llu %12.3f %12.3f\n", PerfCounters::getEventName(event),
+                         (unsigned long long)value, numBytes ? (double)value / numBytes : 0.0,
+                         numTokens ? (double)value / numTokens : 0.0);
+        }
+    }
+    else {
+        os << "Hardware counters are unavailable: " << counters.getError() << "\n";
+    }
+    os << "\n";
+
+    printSoftwareStatistics(buffer);
+
+    if (TheLazyDFA)
+        os << "\nLazy DFA: " << TheLazyDFA->getNumNFAStates() << " NFA states, "
+           << TheLazyDFA->getNumCachedStates() << " cached states in "
+           << TheLazyDFA->getCacheSize() << " bytes, " << TheLazyDFA->getNumFlushes()
+           << " flushes, " << TheLazyDFA->getNumNFASteps() << " bytes matched by the NFA\n";
+}
 
 int main(int argc, const char *argv[])
 {
@@ -29,21 +231,75 @@ int main(int argc, const char *argv[])
         return 1;
     }
 
+    std::unique_ptr<JITGrammar> jitGrammar;
+    if (!JITDFAFile.empty()) {
+        auto dfaBuffer = llvm::MemoryBuffer::getFile(JITDFAFile);
+        if (!dfaBuffer) {
+            WithColor::error(llvm::errs(), "dzieja-lexer")
+                << JITDFAFile << ": " << dfaBuffer.getError().message() << "\n";
+            return 1;
+        }
+        JITDFA dfa;
+        std::string error;
+        if (!dfa.read(dfaBuffer.get()->getBuffer(), error)
+            || !(jitGrammar = JITGrammar::compile(dfa, tok::gap, tok::comment, error))) {
+            WithColor::error(llvm::errs(), "dzieja-lexer") << JITDFAFile << ": " << error << "\n";
+            return 1;
+        }
+        Grammar = &jitGrammar->getGrammar();
+    }
+
+    LexGrammar lazyGrammar = {&matchLazyDFA, tok::gap, tok::comment};
+    if (!LazyNFAFile.empty()) {
+        auto nfaBuffer = llvm::MemoryBuffer::getFile(LazyNFAFile);
+        if (!nfaBuffer) {
+            WithColor::error(llvm::errs(), "dzieja-lexer")
+                << LazyNFAFile << ": " << nfaBuffer.getError().message() << "\n";
+            return 1;
+        }
+        TheLazyDFA = std::make_unique<LazyDFA>(LazyDFACacheSize);
+        std::string error;
+        if (!TheLazyDFA->read(nfaBuffer.get()->getBuffer(), error)) {
+            WithColor::error(llvm::errs(), "dzieja-lexer") << LazyNFAFile << ": " << error << "\n";
+            return 1;
+        }
+        Grammar = &lazyGrammar;
+    }
+
+    if (UsePerfCounters) {
+        measureLexer(*buffer.get());
+        return 0;
+    }
+
     for (int i = 0; i < Repeat; ++i) {
-        Lexer L(buffer.get().get());
-        L.enableCommentRetentionMode();
+        if (UseBasicLexer) {
+            if (NoNullTerminator)
+                lexWithBasicLexer<ToolRangeLexerPolicy>(*buffer.get());
+            else
+                lexWithBasicLexer<ToolLexerPolicy>(*buffer.get());
+            continue;
+        }
+        auto L = createLexer(*buffer.get());
+        if (UseTokenBuffer) {
+            TokenBuffer tokens(L->getBufferStart());
+            tokens.lexAll(*L);
+            for (TokenView T : tokens)
+                printToken(T);
+            continue;
+        }
+        if (UseTokenStream) {
+            TokenStream tokens(*L);
+            const Token *T;
+            do {
+                T = &tokens.next();
+                printToken(*T);
+            } while (!T->is(dzieja::tok::eof));
+            continue;
+        }
         Token T;
         do {
-            L.lex(T);
-            if (PrintTokenName) {
-                llvm::outs() << T.getName();
-                if (PrintTokenSpelling)
-                    llvm::outs() << ": ";
-                else
-                    llvm::outs() << "\n";
-            }
-            if (PrintTokenSpelling)
-                llvm::outs() << T.getSpelling() << "\n";
+            L->lex(T);
+            printToken(T);
         } while (!T.is(dzieja::tok::eof));
     }
 
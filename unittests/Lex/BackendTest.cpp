@@ -0,0 +1,114 @@
+#include "TestGrammars.h"
+
+#include "dzieja/Lex/LazyDFA.h"
+#include "dzieja/Lex/LexGrammar.h"
+#include "dzieja/LexJIT/JITGrammar.h"
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "gtest/gtest.h"
+
+using namespace dzieja;
+using namespace llvm;
+
+namespace {
+
+// Every backend is checked against the transitive table of the same grammar on hand-written inputs
+// and on random strings of fragments of the tokens.
+
+std::vector<std::string> getTestInputs()
+{
+    std::vector<std::string> inputs = {
+        "", "aaaa a aa", "x1f2e3 x1 o7777 o77", "zzz z", "\"a\" \"", "\"\xc2\x80\"",
+        "\x7f\xed\xa0\x80", "\xd0\xb0\xd1\x8f\xd1\x90",
+    };
+    std::vector<std::string> random = makeRandomInputs(2000, 12, TestFragments);
+    inputs.insert(inputs.end(), random.begin(), random.end());
+    return inputs;
+}
+
+std::string readFile(StringRef filename)
+{
+    auto buffer = MemoryBuffer::getFile(filename);
+    EXPECT_TRUE((bool)buffer) << filename.str() << ": " << buffer.getError().message();
+    return buffer ? buffer.get()->getBuffer().str() : "";
+}
+
+template<typename MatchFunction>
+void checkAgainstTable(MatchFunction match)
+{
+    for (const std::string &input : getTestInputs()) {
+        EXPECT_EQ(lexString(input, matchLongestToken<test::TestTableLexDFA>),
+                  lexString(input, match))
+            << "input: \"" << escape(input) << "\"";
+    }
+}
+
+TEST(BackendTest, Switch)
+{
+    checkAgainstTable(matchLongestToken<test::TestSwitchLexDFA>);
+}
+
+TEST(BackendTest, Shuffle)
+{
+    static_assert(shuffle::ShuffleLexDFA::HasShuffleTable,
+                  "the DFA has too many states for the shuffle table");
+
+    static const char *const fragments[] = {"a", "aa", "aaa", "b", "ab", " ", "\n", "q"};
+    for (const std::string &input : makeRandomInputs(2000, 12, fragments)) {
+        EXPECT_EQ(lexString(input, matchLongestToken<shuffle::ShuffleTableLexDFA>,
+                            shuffle::getTokenName),
+                  lexString(input, matchLongestToken<shuffle::ShuffleLexDFA>,
+                            shuffle::getTokenName))
+            << "input: \"" << escape(input) << "\"";
+    }
+}
+
+TEST(BackendTest, LazyDFA)
+{
+    // with the zero budget no state is cached, and all the tokens are matched by the NFA
+    // simulation, and with the small one the cache is flushed again and again
+    for (size_t budget : {(size_t)LazyDFA::DefaultCacheBudget, (size_t)4096, (size_t)0}) {
+        LazyDFA dfa(budget);
+        std::string error;
+        ASSERT_TRUE(dfa.read(readFile(DZIEJA_TEST_NFA_TEXT), error)) << error;
+        checkAgainstTable([&dfa](const char *ptr, unsigned &kind, unsigned &mode) {
+            return dfa.matchLongestToken(ptr, kind, mode);
+        });
+    }
+}
+
+TEST(BackendTest, JIT)
+{
+    JITDFA dfa;
+    std::string error;
+    ASSERT_TRUE(dfa.read(readFile(DZIEJA_TEST_DFA_TEXT), error)) << error;
+    std::unique_ptr<JITGrammar> grammar = JITGrammar::compile(dfa, test::gap, 0, error);
+    ASSERT_TRUE(grammar) << error;
+    checkAgainstTable(grammar->getGrammar().MatchToken);
+}
+
+TEST(BackendTest, JITKeepsModeOfLongerToken)
+{
+    // "a" switches to mode 1, and the longer "ab" keeps the mode
+    JITDFA dfa;
+    dfa.ModeStartStates = {0, 0};
+    dfa.States.resize(3);
+    dfa.States[0].Edges.push_back({'a', 'a', 1});
+    dfa.States[1].Kind = 1;
+    dfa.States[1].NextMode = 1;
+    dfa.States[1].Edges.push_back({'b', 'b', 2});
+    dfa.States[2].Kind = 2;
+
+    std::string error;
+    std::unique_ptr<JITGrammar> grammar = JITGrammar::compile(dfa, 0, 0, error);
+    ASSERT_TRUE(grammar) << error;
+
+    const char input[] = "ab\0";
+    unsigned kind = 0, mode = 0;
+    EXPECT_EQ(input + 2, grammar->getGrammar().MatchToken(input, kind, mode));
+    EXPECT_EQ(2u, kind);
+    EXPECT_EQ(0u, mode);
+}
+
+} // namespace
@@ -0,0 +1,122 @@
+#include "TestGrammars.h"
+
+#include "dzieja/Lex/LexGrammar.h"
+
+#include "gtest/gtest.h"
+
+using namespace dzieja;
+
+namespace {
+
+// The tests lex with the transitive table of TestTokens.def, so they check how dzieja-lexgen builds
+// automata and how the matchers run them.
+
+std::string lex(llvm::StringRef input)
+{
+    return lexString(input, matchLongestToken<test::TestTableLexDFA>);
+}
+
+TEST(GrammarTest, BacktracksToLastAcceptingState)
+{
+    EXPECT_EQ("a(1) eof", lex("a"));
+    EXPECT_EQ("a(1) a(1) eof", lex("aa"));
+    EXPECT_EQ("aaa(3) eof", lex("aaa"));
+    EXPECT_EQ("aaa(3) a(1) eof", lex("aaaa"));
+    EXPECT_EQ("aaa(3) a(1) a(1) eof", lex("aaaaa"));
+    EXPECT_EQ("a(1) a(1) gap(1) a(1) eof", lex("aa a"));
+    EXPECT_EQ("a(1) a(1) error", lex("aaq"));
+}
+
+TEST(GrammarTest, StopsOnNull)
+{
+    // the null_a token continues after the null, but the matchers stop on it
+    const char input[] = "aaaa\0a";
+    const char *end = input + 4;
+    EXPECT_EQ("aaa(3) a(1) eof",
+              lexTokens(input, matchLongestToken<test::TestTableLexDFA>, test::getTokenName));
+
+    // the memo covers positions up to the null only
+    MaximalMunchMemo memo(input, end, test::TestTableLexDFA::InvalidStateID);
+    EXPECT_EQ("aaa(3) a(1) eof",
+              lexTokens(
+                  input,
+                  [&memo](const char *ptr, unsigned &kind, unsigned &mode) {
+                      return matchLongestTokenLinear<test::TestTableLexDFA>(ptr, kind, mode, memo);
+                  },
+                  test::getTokenName));
+
+    // a null inside a range stops the DFA too
+    unsigned kind = 0, mode = 0;
+    EXPECT_EQ(end + 1,
+              matchLongestTokenInRange<test::TestTableLexDFA>(end, end + 2, kind, mode));
+    EXPECT_EQ((unsigned)test::eof, kind);
+}
+
+TEST(GrammarTest, BoundedRepetition)
+{
+    EXPECT_EQ("error", lex("x1"));
+    EXPECT_EQ("hex(3) eof", lex("x1f"));
+    EXPECT_EQ("hex(4) eof", lex("x1f2"));
+    EXPECT_EQ("hex(5) eof", lex("x1f2e"));
+    EXPECT_EQ("hex(5) error", lex("x1f2e3"));
+
+    EXPECT_EQ("error", lex("o77"));
+    EXPECT_EQ("octal(4) eof", lex("o777"));
+    EXPECT_EQ("octal(4) error", lex("o7777"));
+
+    EXPECT_EQ("error", lex("z"));
+    EXPECT_EQ("zs(2) eof", lex("zz"));
+    EXPECT_EQ("zs(40) eof", lex(std::string(40, 'z')));
+}
+
+TEST(GrammarTest, UTF8RangesOfCodePoints)
+{
+    // U+007F, U+0080, U+07FF, U+0800, U+D7FF, U+E000, U+FFFF, U+10000 and U+10FFFF
+    EXPECT_EQ("edges(1) eof", lex("\x7f"));
+    EXPECT_EQ("edges(2) eof", lex("\xc2\x80"));
+    EXPECT_EQ("edges(2) eof", lex("\xdf\xbf"));
+    EXPECT_EQ("edges(3) eof", lex("\xe0\xa0\x80"));
+    EXPECT_EQ("edges(3) eof", lex("\xed\x9f\xbf"));
+    EXPECT_EQ("edges(3) eof", lex("\xee\x80\x80"));
+    EXPECT_EQ("edges(3) eof", lex("\xef\xbf\xbf"));
+    EXPECT_EQ("edges(4) eof", lex("\xf0\x90\x80\x80"));
+    EXPECT_EQ("edges(4) eof", lex("\xf4\x8f\xbf\xbf"));
+    EXPECT_EQ("edges(25) eof", lex("\x7f\xc2\x80\xdf\xbf\xe0\xa0\x80\xed\x9f\xbf\xee\x80\x80"
+                                   "\xef\xbf\xbf\xf0\x90\x80\x80\xf4\x8f\xbf\xbf"));
+
+    // the neighbours out of the ranges: U+0081, U+07FE, U+0801, U+D800 (a surrogate), U+E001,
+    // U+FFFE, U+10001 and the sequence after U+10FFFF
+    EXPECT_EQ("error", lex("\xc2\x81"));
+    EXPECT_EQ("error", lex("\xdf\xbe"));
+    EXPECT_EQ("error", lex("\xe0\xa0\x81"));
+    EXPECT_EQ("error", lex("\xed\xa0\x80"));
+    EXPECT_EQ("error", lex("\xee\x80\x81"));
+    EXPECT_EQ("error", lex("\xef\xbf\xbe"));
+    EXPECT_EQ("error", lex("\xf0\x90\x80\x81"));
+    EXPECT_EQ("error", lex("\xf4\x90\x80\x80"));
+
+    // an overlong encoding of U+007F and incomplete sequences
+    EXPECT_EQ("error", lex("\xc1\xbf"));
+    EXPECT_EQ("error", lex("\xc2"));
+    EXPECT_EQ("edges(2) error", lex("\xc2\x80\xe0\xa0"));
+
+    // а-я are U+0430-U+044F, so the range crosses the second byte 0xBF
+    EXPECT_EQ("cyrillic(6) eof", lex("\xd0\xb0\xd0\xbf\xd1\x8f"));
+    EXPECT_EQ("error", lex("\xd1\x90"));
+}
+
+TEST(GrammarTest, Modes)
+{
+    EXPECT_EQ("quote(1) chars(4) end_quote(1) a(1) eof", lex("\"a aa\"a"));
+    EXPECT_EQ("quote(1) end_quote(1) eof", lex("\"\""));
+    // the null_a token isn't in the string mode, so the string ends on the null with an error
+    EXPECT_EQ("quote(1) chars(3) error", lex("\"aaa"));
+
+    // the mode is switched after the token
+    unsigned kind = 0, mode = test::mode_normal;
+    matchLongestToken<test::TestTableLexDFA>("\"a", kind, mode);
+    EXPECT_EQ((unsigned)test::quote, kind);
+    EXPECT_EQ((unsigned)test::mode_string, mode);
+}
+
+} // namespace
@@ -0,0 +1,125 @@
+#include "TestGrammars.h"
+
+#include "dzieja/Basic/TokenKinds.h"
+#include "dzieja/Lex/BasicLexer.h"
+#include "dzieja/Lex/LexDFA.h"
+#include "dzieja/Lex/LexGrammar.h"
+#include "dzieja/Lex/Token.h"
+
+#include "gtest/gtest.h"
+
+using namespace dzieja;
+
+namespace {
+
+// Slices of a larger buffer are lexed without the null terminator and compared with their copies
+// terminated with the null. The symbol after a slice is never the null, so a matcher that reads it
+// lexes other tokens.
+
+std::string lexRange(const char *begin, const char *end)
+{
+    return lexTokens(
+        begin,
+        [end](const char *ptr, unsigned &kind, unsigned &mode) {
+            return matchLongestTokenInRange<test::TestTableLexDFA>(ptr, end, kind, mode);
+        },
+        test::getTokenName);
+}
+
+TEST(RangeTest, EverySliceOfBuffer)
+{
+    // the inputs are longer than two blocks of matchLongestTokenInRange, so the slices end in
+    // every position of a block
+    std::vector<std::string> inputs = {
+        std::string(40, 'a'),
+        "x1f2e x1f2e3 o777 zzzzzzzzzzzzzzzzzzzz \"aaa aaa\" aa",
+        "\xd0\xb0\xd1\x8f\xd0\xb0\xd1\x8f \xf4\x8f\xbf\xbf\xf0\x90\x80\x80\xe0\xa0\x80\xc2\x80\x7f",
+    };
+    std::vector<std::string> random = makeRandomInputs(40, 30, TestFragments);
+    inputs.insert(inputs.end(), random.begin(), random.end());
+
+    for (const std::string &input : inputs) {
+        // the guard continues the tokens of "a" if the slice ends at the end of the input
+        std::string buffer = input + "aaa";
+        for (size_t begin = 0; begin <= input.size(); begin++) {
+            for (size_t end = begin; end <= input.size(); end++) {
+                llvm::StringRef slice(buffer.data() + begin, end - begin);
+                EXPECT_EQ(lexString(slice, matchLongestToken<test::TestTableLexDFA>),
+                          lexRange(slice.begin(), slice.end()))
+                    << "slice: \"" << escape(slice) << "\"";
+            }
+        }
+    }
+}
+
+struct RecoveringPolicy : DefaultLexerPolicy {
+    static constexpr bool RecoverFromErrors = true;
+};
+
+struct RecoveringRangePolicy : RecoveringPolicy {
+    static constexpr bool RequiresNullTerminator = false;
+};
+
+/// Lexes [\p begin, \p end) with \c BasicLexer and returns the kinds and the lengths of the tokens.
+/// The length of \c eof differs with and without the null terminator, so it is omitted.
+template<typename Policy>
+std::string lexWithBasicLexer(const char *begin, const char *end)
+{
+    BasicLexer<LexDFA, Policy> lexer(begin, begin, end);
+    std::string tokens;
+    Token token;
+    for (lexer.lex(token); !token.is(tok::eof); lexer.lex(token)) {
+        tokens += tok::getTokenName(token.getKind());
+        tokens += '(' + std::to_string(token.getLength()) + ") ";
+    }
+    return tokens + "eof";
+}
+
+TEST(RangeTest, EverySliceWithBasicLexer)
+{
+    std::string input = "byte x1; # note\n{ (ident) } ? u8 y.z:w [a]\r\n\t\"end";
+    std::string buffer = input + "aaa";
+    for (size_t begin = 0; begin <= input.size(); begin++) {
+        for (size_t end = begin; end <= input.size(); end++) {
+            std::string copy = buffer.substr(begin, end - begin) + '\0';
+            EXPECT_EQ(lexWithBasicLexer<RecoveringPolicy>(copy.data(),
+                                                          copy.data() + end - begin),
+                      lexWithBasicLexer<RecoveringRangePolicy>(buffer.data() + begin,
+                                                               buffer.data() + end))
+                << "slice: \"" << escape(copy.substr(0, end - begin)) << "\"";
+        }
+    }
+}
+
+/// Lexes [\p begin, \p end) up to \c eof with \c BasicLexer, and checks that \c eof is returned
+/// at \p end again without stepping past it.
+template<typename Policy>
+void checkEofRepeats(const char *begin, const char *end)
+{
+    BasicLexer<LexDFA, Policy> lexer(begin, begin, end);
+    Token token;
+    do {
+        lexer.lex(token);
+    } while (!token.is(tok::eof));
+    for (unsigned i = 0; i < 3; i++) {
+        EXPECT_EQ(end, token.getBufferPtr());
+        lexer.lex(token);
+        EXPECT_TRUE(token.is(tok::eof));
+    }
+    EXPECT_EQ(end, token.getBufferPtr());
+}
+
+TEST(RangeTest, EofRepeatsAtEnd)
+{
+    // the identifier would continue after the end of the range, and "zzz" after the null
+    const char input[] = "a ab\0zzz";
+    const char *end = input + 4;
+    EXPECT_EQ("identifier(1) identifier(2) eof", lexWithBasicLexer<RecoveringPolicy>(input, end));
+    EXPECT_EQ("identifier(1) identifier(1) eof",
+              lexWithBasicLexer<RecoveringRangePolicy>(input, input + 3));
+    checkEofRepeats<RecoveringPolicy>(input, end);
+    checkEofRepeats<RecoveringRangePolicy>(input, end);
+    checkEofRepeats<RecoveringRangePolicy>(input, input + 3);
+}
+
+} // namespace
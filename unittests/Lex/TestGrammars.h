@@ -0,0 +1,153 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// The file contains the DFAs of the test grammars and helpers lexing a string into a readable list
+/// of tokens, so the results of different matchers can be compared with \c EXPECT_EQ.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_UNITTESTS_LEX_TESTGRAMMARS_H
+#define DZIEJA_UNITTESTS_LEX_TESTGRAMMARS_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <assert.h>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dzieja {
+
+/// Grammar of \c TestTokens.def generated as the transitive table (\c TestTableLexDFA) and as code
+/// with switches (\c TestSwitchLexDFA).
+namespace test {
+
+enum TokenKind : unsigned short {
+#define TOK(name) name,
+#include "TestTokens.def"
+    NUM_TOKENS
+};
+
+enum LexMode : unsigned {
+#define MODE(name) mode_##name,
+#include "TestTokens.def"
+};
+
+inline const char *getTokenName(unsigned kind)
+{
+    static const char *const Names[] = {
+#define TOK(name) #name,
+#include "TestTokens.def"
+    };
+    return kind < NUM_TOKENS ? Names[kind] : "<invalid>";
+}
+
+#include "TestSwitchDFA.inc"
+#include "TestTableDFA.inc"
+
+} // namespace test
+
+/// Grammar of \c ShuffleTokens.def generated as the transitive table (\c ShuffleTableLexDFA) and
+/// as the shuffle table (\c ShuffleLexDFA).
+namespace shuffle {
+
+enum TokenKind : unsigned short {
+#define TOK(name) name,
+#include "ShuffleTokens.def"
+    NUM_TOKENS
+};
+
+inline const char *getTokenName(unsigned kind)
+{
+    static const char *const Names[] = {
+#define TOK(name) #name,
+#include "ShuffleTokens.def"
+    };
+    return kind < NUM_TOKENS ? Names[kind] : "<invalid>";
+}
+
+#include "ShuffleDFA.inc"
+#include "ShuffleTableDFA.inc"
+
+} // namespace shuffle
+
+static_assert(test::eof == 1 && shuffle::eof == 1, "eof is expected to be the first token");
+
+/// Lexes tokens from \p ptr with \p match, which is called as \c matchLongestToken, until \c eof or
+/// a symbol no token starts with. Returns the tokens as "kind(length)" separated by spaces, \c eof
+/// without the length and "error" for the symbol. \p match returns \p ptr or null if no token
+/// matches, so the matchers with and without the null terminator are compared by the same list.
+template<typename MatchFunction>
+std::string lexTokens(const char *ptr, MatchFunction match, const char *(*getTokenName)(unsigned))
+{
+    std::string tokens;
+    unsigned mode = 0;
+    for (;;) {
+        unsigned kind = 0;
+        const char *end = match(ptr, kind, mode);
+        if (!tokens.empty())
+            tokens += ' ';
+        if (kind == test::eof && end) {
+            tokens += "eof";
+            return tokens;
+        }
+        if (!end || end == ptr) {
+            tokens += "error";
+            return tokens;
+        }
+        tokens += getTokenName(kind);
+        tokens += '(' + std::to_string(end - ptr) + ')';
+        ptr = end;
+    }
+}
+
+/// Lexes \p input with a matcher that needs the null terminator, see \c lexTokens.
+template<typename MatchFunction>
+std::string lexString(llvm::StringRef input, MatchFunction match,
+                      const char *(*getTokenName)(unsigned) = test::getTokenName)
+{
+    // the "a" after the null would make the null_a token, so a matcher reading it is caught
+    std::string buffer = input.str() + std::string("\0a", 2);
+    return lexTokens(buffer.c_str(), match, getTokenName);
+}
+
+/// Returns \p input with non-printable symbols escaped, for messages of failed checks.
+inline std::string escape(llvm::StringRef input)
+{
+    std::string result;
+    llvm::raw_string_ostream out(result);
+    out.write_escaped(input, /*UseHexEscapes=*/true);
+    return out.str();
+}
+
+/// Returns \p count strings of up to \p maxFragments of \p fragments chosen at random. The
+/// generator has a fixed seed, so the strings are the same in every run.
+inline std::vector<std::string> makeRandomInputs(unsigned count, unsigned maxFragments,
+                                                 llvm::ArrayRef<const char *> fragments)
+{
+    std::minstd_rand random(2024);
+    std::vector<std::string> inputs;
+    for (unsigned i = 0; i < count; i++) {
+        std::string input;
+        for (unsigned n = random() % (maxFragments + 1); n != 0; n--)
+            input += fragments[random() % fragments.size()];
+        inputs.push_back(input);
+    }
+    return inputs;
+}
+
+/// Fragments of inputs for \c TestTokens.def: parts of every token, UTF-8 sequences in and out of
+/// the ranges and incomplete ones.
+static const char *const TestFragments[] = {
+    "a", "aa", "aaa", "x", "1", "f", "o", "7", "z", " ", "\n", "\"", "q",
+    "\x7f", "\xc2\x80", "\xc2\x81", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xed\xa0\x80",
+    "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", "\xf4\x90\x80\x80",
+    "\xd0\xb0", "\xd1\x8f", "\xc2", "\x80",
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_UNITTESTS_LEX_TESTGRAMMARS_H
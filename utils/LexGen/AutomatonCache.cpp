@@ -0,0 +1,80 @@
+#include "AutomatonCache.h"
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/WithColor.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+namespace dzieja {
+
+/// Must be changed every time the format or meaning of cached automata is changed.
+static const char *const CacheHeader = "dzieja-lexgen-cache 3\n";
+
+// The file consists of the header, the line with the tool's identifier, and a sequence of entries:
+//   tool <tool ID>\n
+//   entry <key length>\n<key>\n<automaton written with NFA::write>
+
+void AutomatonCache::load(StringRef filename)
+{
+    Entries.clear();
+    if (ToolID.empty())
+        return;
+    auto buffer = MemoryBuffer::getFile(filename);
+    if (!buffer)
+        return;
+
+    StringRef text = buffer.get()->getBuffer();
+    if (!text.consume_front(CacheHeader) || !text.consume_front("tool " + ToolID + "\n"))
+        return;
+
+    std::map<std::string, NFA> entries;
+    while (!(text = text.ltrim()).empty()) {
+        size_t keyLength;
+        if (!text.consume_front("entry ") || text.consumeInteger(10, keyLength)
+            || !text.consume_front("\n") || text.size() < keyLength)
+            return;
+        std::string key = text.substr(0, keyLength).str();
+        text = text.drop_front(keyLength);
+
+        NFA automaton;
+        if (!automaton.read(text))
+            return;
+        entries[key] = std::move(automaton);
+    }
+    Entries = std::move(entries);
+}
+
+bool AutomatonCache::save(StringRef filename) const
+{
+    std::error_code EC;
+    raw_fd_ostream out(filename, EC);
+    if (EC) {
+        WithColor::error(llvm::errs(), "dzieja-lexgen") << EC.message() << "\n";
+        return false;
+    }
+    out << CacheHeader;
+    out << "tool " << ToolID << "\n";
+    for (const auto &item : Entries) {
+        out << "entry " << item.first.size() << "\n" << item.first << "\n";
+        item.second.write(out);
+    }
+    return true;
+}
+
+bool AutomatonCache::take(const std::string &key, NFA &result)
+{
+    auto iter = Entries.find(key);
+    if (iter == Entries.end())
+        return false;
+    result = std::move(iter->second);
+    Entries.erase(iter);
+    return true;
+}
+
+void AutomatonCache::insert(const std::string &key, NFA &&automaton)
+{
+    Entries[key] = std::move(automaton);
+}
+
+} // namespace dzieja
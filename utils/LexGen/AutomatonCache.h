@@ -0,0 +1,51 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// This file contains the declaration of \c AutomatonCache — a file with automata built by the
+/// previous run of LexGen.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_UTILS_LEXGEN_AUTOMATONCACHE_H
+#define DZIEJA_UTILS_LEXGEN_AUTOMATONCACHE_H
+
+#include "FiniteAutomaton.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <map>
+#include <string>
+
+namespace dzieja {
+
+/// Set of automata identified with string keys. A key must contain everything the automaton is
+/// built from, e.g. a token regex, so an automaton with the same key can be reused.
+class AutomatonCache {
+    std::map<std::string, NFA> Entries;
+
+    /// Identifier of the build of the tool, which is written to the header of the file.
+    std::string ToolID;
+
+public:
+    /// \p toolID identifies the build of the tool, e.g. with a hash of its executable. Automata
+    /// written by another build aren't loaded, and an empty \p toolID disables loading at all.
+    explicit AutomatonCache(llvm::StringRef toolID) : ToolID(toolID.str()) {}
+
+    /// Loads entries from \p filename. A missing file or a file written by another version of the
+    /// cache format or by another build of the tool gives an empty cache.
+    void load(llvm::StringRef filename);
+
+    bool save(llvm::StringRef filename) const;
+
+    /// Moves the automaton with \p key into \p result and removes it from the cache. Returns false
+    /// if there is no such automaton.
+    bool take(const std::string &key, NFA &result);
+
+    void insert(const std::string &key, NFA &&automaton);
+
+    size_t size() const { return Entries.size(); }
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_UTILS_LEXGEN_AUTOMATONCACHE_H
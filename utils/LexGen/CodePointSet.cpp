@@ -0,0 +1,126 @@
+#include "CodePointSet.h"
+
+#include <algorithm>
+#include <cassert>
+
+#define UNI_SUR_HIGH_START (UTF32)0xD800
+#define UNI_SUR_LOW_END (UTF32)0xDFFF
+
+using namespace llvm;
+
+namespace dzieja {
+
+void CodePointSet::add(UTF32 first, UTF32 last)
+{
+    assert(first <= last && "range must be consecutive");
+
+    // the first range that can be merged with the new one, i.e. it ends not before first - 1
+    auto begin = std::lower_bound(Ranges.begin(), Ranges.end(), first, [](const Range &r, UTF32 p) {
+        return r.second + 1 < p;
+    });
+    auto end = begin;
+    while (end != Ranges.end() && end->first <= last + 1) {
+        first = std::min(first, end->first);
+        last = std::max(last, end->second);
+        ++end;
+    }
+    if (begin == end) {
+        Ranges.insert(begin, {first, last});
+        return;
+    }
+    *begin = {first, last};
+    Ranges.erase(begin + 1, end);
+}
+
+CodePointSet CodePointSet::complement() const
+{
+    CodePointSet result;
+    UTF32 next = 0;
+    for (const Range &r : Ranges) {
+        if (next < r.first)
+            result.Ranges.push_back({next, r.first - 1});
+        next = r.second + 1;
+    }
+    if (next <= UNI_MAX_LEGAL_UTF32)
+        result.Ranges.push_back({next, UNI_MAX_LEGAL_UTF32});
+    return result;
+}
+
+CodePointSet CodePointSet::withoutSurrogates() const
+{
+    CodePointSet result;
+    for (const Range &r : Ranges) {
+        if (r.second < UNI_SUR_HIGH_START || UNI_SUR_LOW_END < r.first) {
+            result.Ranges.push_back(r);
+            continue;
+        }
+        if (r.first < UNI_SUR_HIGH_START)
+            result.Ranges.push_back({r.first, UNI_SUR_HIGH_START - 1});
+        if (UNI_SUR_LOW_END < r.second)
+            result.Ranges.push_back({UNI_SUR_LOW_END + 1, r.second});
+    }
+    return result;
+}
+
+/// Splits [\p first, \p last] into ranges, every of which has the same UTF-8 length, and in every
+/// position of its UTF-8 sequences the bytes form a continuous range.
+static void splitUTF8Range(UTF32 first, UTF32 last, SmallVectorImpl<UTF8Sequence> &result)
+{
+    if (first > last)
+        return;
+
+    // ranges must have the same length of UTF-8 sequence
+    for (UTF32 max : {0x7Fu, 0x7FFu, 0xFFFFu}) {
+        if (first <= max && max < last) {
+            splitUTF8Range(first, max, result);
+            splitUTF8Range(max + 1, last, result);
+            return;
+        }
+    }
+
+    // every continuation byte keeps 6 bits, so the ranges must be aligned to 6-bit boundaries
+    for (unsigned i = 1; i < UNI_MAX_UTF8_BYTES_PER_CODE_POINT; i++) {
+        UTF32 mask = (1u << (6 * i)) - 1;
+        if ((first & ~mask) == (last & ~mask))
+            continue;
+        if ((first & mask) != 0) {
+            splitUTF8Range(first, first | mask, result);
+            splitUTF8Range((first | mask) + 1, last, result);
+            return;
+        }
+        if ((last & mask) != mask) {
+            splitUTF8Range(first, (last & ~mask) - 1, result);
+            splitUTF8Range(last & ~mask, last, result);
+            return;
+        }
+    }
+
+    char firstSeq[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+    char lastSeq[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+    char *firstEnd = firstSeq;
+    char *lastEnd = lastSeq;
+    bool converted = ConvertCodePointToUTF8(first, firstEnd);
+    converted &= ConvertCodePointToUTF8(last, lastEnd);
+    (void)converted;
+    assert(converted && "can't convert code point into UTF8 sequence");
+    assert(firstEnd - firstSeq == lastEnd - lastSeq && "UTF8 sequences must have equal lengths");
+
+    UTF8Sequence seq;
+    seq.Length = firstEnd - firstSeq;
+    for (unsigned i = 0; i < seq.Length; i++) {
+        seq.Lo[i] = firstSeq[i];
+        seq.Hi[i] = lastSeq[i];
+    }
+    result.push_back(seq);
+}
+
+void CodePointSet::getUTF8Sequences(SmallVectorImpl<UTF8Sequence> &result) const
+{
+    for (const Range &r : Ranges) {
+        assert((r.second < UNI_SUR_HIGH_START || UNI_SUR_LOW_END < r.first)
+               && "surrogates can't be encoded in UTF8");
+        splitUTF8Range(r.first, r.second, result);
+    }
+}
+
+} // namespace dzieja
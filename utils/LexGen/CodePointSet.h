@@ -0,0 +1,63 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// This file contains the declaration of \c CodePointSet — a compact set of Unicode code points
+/// used for `[]`-expressions of regexes.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_UTILS_LEXGEN_CODEPOINTSET_H
+#define DZIEJA_UTILS_LEXGEN_CODEPOINTSET_H
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/ConvertUTF.h>
+
+#include <utility>
+
+namespace dzieja {
+
+/// Sequence of byte ranges matching a range of code points encoded in UTF-8. For example, the
+/// sequence [D0-D3][80-BF] matches all the code points from \c 0400 to \c 04FF.
+struct UTF8Sequence {
+    unsigned Length;
+    unsigned char Lo[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+    unsigned char Hi[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+};
+
+/// Set of Unicode code points kept as a sorted list of disjoint closed ranges.
+///
+/// The list is always canonical: ranges are sorted and neither overlap nor touch each other. So two
+/// equal sets have equal lists, and the set can be used as a key of a cache.
+class CodePointSet {
+public:
+    using Range = std::pair<llvm::UTF32, llvm::UTF32>;
+
+private:
+    llvm::SmallVector<Range, 4> Ranges;
+
+public:
+    /// Adds the closed range [\p first, \p last] to the set.
+    void add(llvm::UTF32 first, llvm::UTF32 last);
+    void add(llvm::UTF32 point) { add(point, point); }
+
+    /// Returns all the code points between \c 0 and \c UNI_MAX_LEGAL_UTF32 that are not in the set.
+    CodePointSet complement() const;
+
+    /// Returns the same set without the surrogate range \c D800-DFFF.
+    CodePointSet withoutSurrogates() const;
+
+    /// Splits the set into UTF-8 byte range sequences, like RE2 and utf8-ranges do. The set must
+    /// not contain surrogates. The result is sorted, and the number of the sequences is
+    /// proportional to the number of ranges, not to the number of code points.
+    void getUTF8Sequences(llvm::SmallVectorImpl<UTF8Sequence> &result) const;
+
+    bool empty() const { return Ranges.empty(); }
+    const llvm::SmallVectorImpl<Range> &ranges() const { return Ranges; }
+
+    bool operator==(const CodePointSet &other) const { return Ranges == other.Ranges; }
+    bool operator<(const CodePointSet &other) const { return Ranges < other.Ranges; }
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_UTILS_LEXGEN_CODEPOINTSET_H
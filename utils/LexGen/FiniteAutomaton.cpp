@@ -5,16 +5,22 @@
 #include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/WithColor.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <map>
-
-#define UNI_SUR_HIGH_START (UTF32)0xD800
-#define UNI_SUR_LOW_END (UTF32)0xDFFF
+#include <type_traits>
+#include <vector>
 
 using namespace llvm;
 using namespace std;
@@ -32,12 +38,25 @@ static cl::opt<MinimizationAlgorithm>
                                     "Minimizing algorithm with complexity O(N^2). It can\n"
                                     "   use a lot of memory.")));
 
-static cl::opt<bool>
+static cl::opt<unsigned>
+    NumThreads("j", cl::init(1),
+               cl::desc("Number of threads used for DFA minimization. 0 means all the\n"
+                        "available cores. The result doesn't depend on it."),
+               cl::value_desc("N"));
+
+cl::opt<bool>
     UnifyTokenKinds("unify-token-kinds", cl::init(false),
                     cl::desc("With this option LexGen won't distinguish different\n"
                              "types of tokens if they match with some kinds at the\n"
                              "same time."));
 
+std::string getAutomatonOptions()
+{
+    std::string options = MinimAlgo == MA_O2 ? "use-min-algo-o2" : "use-min-algo-o4";
+    options += UnifyTokenKinds ? " unify-token-kinds" : "";
+    return options;
+}
+
 static auto &error()
 {
     return WithColor::error(llvm::errs(), "dzieja-lexgen");
@@ -53,6 +72,26 @@ static bool areDistinguishable(const SmallVector<BitVector, 0> &table, StateID l
         return table[rightID][leftID];
 }
 
+/// Checks if there is a symbol leading states \p i and \p j into distinguishable states.
+template<typename TransitiveTable>
+static bool haveDistinguishableTargets(const SmallVector<BitVector, 0> &table,
+                                       const TransitiveTable &transTable, StateID i, StateID j,
+                                       StateID invalidID)
+{
+    for (Symbol c = 0u; c <= MaxSymbolValue; c++) {
+        StateID nextIid = transTable[i][c];
+        StateID nextJid = transTable[j][c];
+        if (nextIid == invalidID || nextJid == invalidID) {
+            if (nextIid != nextJid)
+                return true;
+        }
+        else if (areDistinguishable(table, nextIid, nextJid)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 StateSet State::getEspClosure() const
 {
     StateSet closure;
@@ -61,7 +100,7 @@ StateSet State::getEspClosure() const
             return;
         closure.insert(state);
         for (const Edge &edge : state->getEdges())
-            if (edge.getSymbol() == Epsilon)
+            if (edge.isEpsilon())
                 finderRef(edge.getTarget(), finderRef);
     };
     finder(this, finder);
@@ -79,9 +118,28 @@ raw_ostream &operator<<(raw_ostream &out, const State &state)
     return out;
 }
 
+void State::growEdges()
+{
+    unsigned newCapacity = EdgesCapacity ? EdgesCapacity * 2 : 2;
+    Edge *newEdges = Allocator->Allocate<Edge>(newCapacity);
+    std::uninitialized_copy(Edges, Edges + NumEdges, newEdges);
+    // the old array stays in the allocator until the NFA is cleared
+    Edges = newEdges;
+    EdgesCapacity = newCapacity;
+}
+
 void NFA::clear()
 {
+    if (Allocator)
+        Allocator->Reset();
+    else
+        Allocator = std::make_unique<BumpPtrAllocator>();
     Storage.clear();
+    SquareCache.clear();
+    CanonicalIDs.clear();
+    ModeStartIDs.clear();
+    NextModes.clear();
+    NumRepeatStates = 0;
     Q0 = makeState();
     IsDFA = false;
 }
@@ -109,6 +167,113 @@ void NFA::parseRegex(const char *expr, tok::TokenKind kind)
     assert(*expr == '\0' && "parsing must be finished with zero character");
 }
 
+void NFA::appendAutomaton(const NFA &other, tok::TokenKind kind)
+{
+    StateID offset = Storage.size();
+    for (const State *state : other.Storage) {
+        tok::TokenKind newKind = state->getKind();
+        if (state->isTerminal() && kind != tok::unknown)
+            newKind = kind;
+        makeState(newKind);
+    }
+    for (const State *state : other.Storage)
+        for (const Edge &edge : state->getEdges())
+            Storage[offset + state->getID()]->connectTo(
+                Storage[offset + edge.getTarget()->getID()], edge.getLo(), edge.getHi());
+    Q0->connectTo(Storage[offset + other.Q0->getID()], Epsilon);
+}
+
+void NFA::write(raw_ostream &out) const
+{
+    // automaton <number of states> <start state ID> <is DFA>
+    // <kind> <number of edges> [<lo> <hi> <target>]...   -- one line for every state
+    // modes <number of modes> <start state ID>...   -- only for an automaton with several modes
+    // next-modes <next mode>...   -- one number for every state, only if modes are switched
+    out << "automaton " << Storage.size() << " " << Q0->getID() << " " << IsDFA << "\n";
+    for (const State *state : Storage) {
+        out << state->getKind() << " " << state->getEdges().size();
+        for (const Edge &edge : state->getEdges())
+            out << " " << edge.getLo() << " " << edge.getHi() << " " << edge.getTarget()->getID();
+        out << "\n";
+    }
+    if (!ModeStartIDs.empty()) {
+        out << "modes " << ModeStartIDs.size();
+        for (StateID id : ModeStartIDs)
+            out << " " << id;
+        out << "\n";
+    }
+    if (!NextModes.empty()) {
+        out << "next-modes";
+        for (unsigned mode : NextModes)
+            out << " " << mode;
+        out << "\n";
+    }
+}
+
+bool NFA::read(StringRef &text)
+{
+    auto readNumber = [&text](unsigned &number) {
+        text = text.ltrim();
+        return !text.consumeInteger(10, number);
+    };
+
+    text = text.ltrim();
+    if (!text.consume_front("automaton"))
+        return false;
+    unsigned numStates, startID, isDFA;
+    if (!readNumber(numStates) || !readNumber(startID) || !readNumber(isDFA) || numStates == 0
+        || startID >= numStates)
+        return false;
+
+    clear();
+    Storage.pop_back();
+    for (unsigned i = 0; i < numStates; i++)
+        makeState();
+    Q0 = Storage[startID];
+    IsDFA = isDFA;
+    for (State *state : Storage) {
+        unsigned kind, numEdges;
+        if (!readNumber(kind) || !readNumber(numEdges)
+            || kind > std::numeric_limits<std::underlying_type<tok::TokenKind>::type>::max())
+            return false;
+        state->setKind((tok::TokenKind)kind);
+        for (unsigned i = 0; i < numEdges; i++) {
+            unsigned lo, hi, target;
+            if (!readNumber(lo) || !readNumber(hi) || !readNumber(target) || target >= numStates)
+                return false;
+            bool isValidRange = lo <= hi && hi <= MaxSymbolValue;
+            if (!isValidRange && !(lo == Epsilon && hi == Epsilon))
+                return false;
+            state->connectTo(Storage[target], lo, hi);
+        }
+    }
+
+    text = text.ltrim();
+    if (text.consume_front("modes ")) {
+        unsigned numModes;
+        if (!readNumber(numModes) || numModes < 2)
+            return false;
+        for (unsigned mode = 0; mode < numModes; mode++) {
+            unsigned id;
+            if (!readNumber(id) || id >= numStates)
+                return false;
+            ModeStartIDs.push_back(id);
+        }
+        if (Q0->getID() != ModeStartIDs[0])
+            return false;
+    }
+    text = text.ltrim();
+    if (text.consume_front("next-modes ")) {
+        for (unsigned id = 0; id < numStates; id++) {
+            unsigned mode;
+            if (!readNumber(mode) || mode >= getNumModes())
+                return false;
+            NextModes.push_back(mode);
+        }
+    }
+    return true;
+}
+
 NFA::SubAutomaton NFA::parseSequence(const char *&expr)
 {
     auto *firstState = makeState();
@@ -182,9 +347,7 @@ static UTF32 parseUnicodeEscape(const char *&expr)
     return uniPoint;
 }
 
-/// Parse a symbol and returns its unicode point. It doesn't create \p SubAutomaton unlike
-/// \p parseSymbol method.
-static UTF32 parseSymbolCodePoint(const char *&expr)
+UTF32 parseSymbolCodePoint(const char *&expr)
 {
     UTF32 uniPoint;
     if (*expr & 0x80) { // is not an ASCII char
@@ -223,7 +386,7 @@ static UTF32 parseSymbolCodePoint(const char *&expr)
                 break;
             // clang-format off
             case '(': case ')': case '[': case ']': case '-': case '\\':
-            case '^': case '|': case '+': case '*': case '?':
+            case '^': case '|': case '+': case '*': case '?': case '{': case '}':
                 uniPoint = (unsigned char)*expr;
                 break;
             // clang-format on
@@ -280,7 +443,7 @@ NFA::SubAutomaton NFA::parseParen(const char *&expr)
     return autom;
 }
 
-NFA::SubAutomaton NFA::parseSquare(const char *&expr)
+CodePointSet parseSquareCodePoints(const char *&expr)
 {
     assert(*expr == '[' && "open paren '[' is exptected");
 
@@ -290,141 +453,103 @@ NFA::SubAutomaton NFA::parseSquare(const char *&expr)
         isNegative = true;
         ++expr;
     }
-    llvm::BitVector unicodeMask; // marks if an element must be include in the range of chars
-    unicodeMask.resize(UNI_MAX_LEGAL_UTF32 + 1, isNegative);
-
+    CodePointSet codePoints;
     while (*expr != ']') {
         UTF32 firstPoint = parseSymbolCodePoint(expr);
-        unicodeMask[firstPoint] = !isNegative;
-
+        UTF32 secondPoint = firstPoint;
         if (*expr == '-') {
             ++expr;
-            UTF32 secondPoint = parseSymbolCodePoint(expr);
+            secondPoint = parseSymbolCodePoint(expr);
             if (secondPoint < firstPoint) {
                 auto &err = error() << "character range in [";
                 err << StringRef(startSource, expr - startSource) << "] is not consecutive\n";
                 std::exit(1);
             }
-            for (Symbol c = firstPoint; c <= secondPoint; c++)
-                unicodeMask[c] = !isNegative;
         }
+        codePoints.add(firstPoint, secondPoint);
     }
     ++expr;
-    return buildSquareSubAutom(unicodeMask);
+    if (isNegative)
+        codePoints = codePoints.complement();
+    return codePoints.withoutSurrogates();
+}
+
+NFA::SubAutomaton NFA::parseSquare(const char *&expr)
+{
+    CodePointSet codePoints = parseSquareCodePoints(expr);
+    auto iter = SquareCache.find(codePoints);
+    if (iter != SquareCache.end())
+        return instantiatePattern(iter->second);
+    auto autom = buildSquareSubAutom(codePoints);
+    SquareCache[codePoints] = makePattern(autom);
+    return autom;
 }
 
-NFA::SubAutomaton NFA::buildSquareSubAutom(const llvm::BitVector &unicodeMask)
+NFA::SubAutomaton NFA::buildSquareSubAutom(const CodePointSet &codePoints)
 {
-    DenseMap<char, StateID> secondCache;
-    DenseMap<char, DenseMap<char, StateID>> thirdCache;
-    DenseMap<char, DenseMap<char, DenseMap<char, StateID>>> fourthCache;
-    DenseMap<StateID, BitVector> bitMap;
+    SmallVector<UTF8Sequence, 16> sequences;
+    codePoints.getUTF8Sequences(sequences);
+
+    // Every sequence becomes a chain of states from the first state to the last one. Tails of the
+    // chains are shared, so the number of states is proportional to the number of sequences. Since
+    // the sequences are sorted, that sharing gives the most of states reduction, and the rest is
+    // done by DFA building and minimization.
+    std::map<std::tuple<unsigned char, unsigned char, const State *>, State *> suffixCache;
     auto *firstState = makeState();
     auto *lastState = makeState();
-    StateID idCounter = 3;
-    for (UTF32 c = 0; c <= UNI_MAX_LEGAL_UTF32; c++) {
-        if ((c < UNI_SUR_HIGH_START || UNI_SUR_LOW_END < c) && unicodeMask[c]) {
-            SmallString<UNI_MAX_UTF8_BYTES_PER_CODE_POINT> u8Seq;
-            u8Seq.set_size(UNI_MAX_UTF8_BYTES_PER_CODE_POINT);
-            char *ptr = u8Seq.data();
-            if (!ConvertCodePointToUTF8(c, ptr)) {
-                auto &err = error() << "can't convert code point ";
-                err.write_hex(c) << " into UTF8 sequence\n";
-                std::exit(1);
-            }
-            unsigned size = ptr - u8Seq.data();
-            assert(0 < size && size <= 4);
-
-            if (size == 1) {
-                firstState->connectTo(lastState, u8Seq[0]);
-            }
-            else {
-                StateID secondID = secondCache[u8Seq[0]];
-                if (!secondID)
-                    secondCache[u8Seq[0]] = secondID = ++idCounter;
-                if (size == 2) {
-                    auto &mask = bitMap[secondID];
-                    if (mask.empty())
-                        mask.resize(MaxSymbolValue + 1);
-                    mask[(unsigned char)u8Seq[size - 1]] = true;
-                }
-                else {
-                    StateID thirdID = thirdCache[u8Seq[0]][u8Seq[1]];
-                    if (!thirdID)
-                        thirdCache[u8Seq[0]][u8Seq[1]] = thirdID = ++idCounter;
-                    if (size == 3) {
-                        auto &mask = bitMap[thirdID];
-                        if (mask.empty())
-                            mask.resize(MaxSymbolValue + 1);
-                        mask[(unsigned char)u8Seq[size - 1]] = true;
-                    }
-                    else {
-                        StateID fourthID = fourthCache[u8Seq[0]][u8Seq[1]][u8Seq[2]];
-                        if (!fourthID)
-                            fourthCache[u8Seq[0]][u8Seq[1]][u8Seq[2]] = fourthID = ++idCounter;
-                        if (size == 4) {
-                            auto &mask = bitMap[fourthID];
-                            if (mask.empty())
-                                mask.resize(MaxSymbolValue + 1);
-                            mask[(unsigned char)u8Seq[size - 1]] = true;
-                        }
-                        else {
-                            llvm_unreachable("max length of a UTF8 sequence is 4");
-                        }
-                    }
-                }
+    for (const UTF8Sequence &seq : sequences) {
+        State *target = lastState;
+        for (unsigned i = seq.Length - 1; i > 0; i--) {
+            State *&state = suffixCache[std::make_tuple(seq.Lo[i], seq.Hi[i], target)];
+            if (!state) {
+                state = makeState();
+                state->connectTo(target, seq.Lo[i], seq.Hi[i]);
             }
+            target = state;
         }
+        firstState->connectTo(target, seq.Lo[0], seq.Hi[0]);
     }
+    return {firstState, lastState};
+}
 
-    DenseMap<BitVector, State *> maskToState;
-    DenseMap<StateID, State *> stateIdToPtr;
-    for (const auto &I : bitMap) {
-        State *state = maskToState[I.second];
-        if (!state) {
-            state = makeState();
-            maskToState[I.second] = state;
-            for (Symbol c = 0; c <= MaxSymbolValue; ++c)
-                if (I.second[c])
-                    state->connectTo(lastState, c);
-        }
-        stateIdToPtr[I.first] = state;
+void parseRepeatBounds(const char *&expr, unsigned &min, unsigned &max)
+{
+    assert(*expr == '{' && "open brace '{' is exptected");
+
+    const char *startSource = expr++;
+    auto parseNumber = [&expr](unsigned &number) {
+        if (!std::isdigit((unsigned char)*expr))
+            return false;
+        number = 0;
+        for (; std::isdigit((unsigned char)*expr); ++expr)
+            number = std::min(number * 10 + (*expr - '0'), MaxRepeatCount + 1);
+        return true;
+    };
+    bool isValid = parseNumber(min);
+    max = min;
+    if (isValid && *expr == ',') {
+        ++expr;
+        if (!parseNumber(max))
+            max = RepeatUnbounded;
     }
-
-    for (const auto &I : secondCache) {
-        StateID stateID = I.second;
-        auto *state = stateIdToPtr[stateID];
-        if (!state)
-            stateIdToPtr[stateID] = state = makeState();
-        firstState->connectTo(state, I.first);
+    isValid = isValid && *expr == '}';
+    const char *endSource = *expr ? expr + 1 : expr;
+    if (!isValid) {
+        error() << "quantifier " << StringRef(startSource, endSource - startSource)
+                << " is malformed, {m}, {m,} or {m,n} is expected\n";
+        std::exit(1);
     }
-
-    for (const auto &J : thirdCache) {
-        auto *secondState = stateIdToPtr[secondCache[J.first]];
-        for (const auto &I : J.second) {
-            StateID stateID = I.second;
-            auto *state = stateIdToPtr[stateID];
-            if (!state)
-                stateIdToPtr[stateID] = state = makeState();
-            secondState->connectTo(state, I.first);
-        }
+    if (min > MaxRepeatCount || (max != RepeatUnbounded && max > MaxRepeatCount)) {
+        error() << "quantifier " << StringRef(startSource, endSource - startSource)
+                << " has a count greater than " << MaxRepeatCount << "\n";
+        std::exit(1);
     }
-
-    for (const auto &K : fourthCache) {
-        auto *secondState = stateIdToPtr[secondCache[K.first]];
-        for (const auto &J : K.second) {
-            auto *thirdState = stateIdToPtr[thirdCache[K.first][J.first]];
-            secondState->connectTo(thirdState, J.first);
-            for (const auto &I : J.second) {
-                StateID stateID = I.second;
-                auto *state = stateIdToPtr[stateID];
-                if (!state)
-                    stateIdToPtr[stateID] = state = makeState();
-                thirdState->connectTo(state, I.first);
-            }
-        }
+    if (max < min) {
+        error() << "quantifier " << StringRef(startSource, endSource - startSource)
+                << " has the maximum less than the minimum\n";
+        std::exit(1);
     }
-    return {firstState, lastState};
+    expr = endSource;
 }
 
 NFA::SubAutomaton NFA::parseQualifier(const char *&expr, SubAutomaton autom)
@@ -439,10 +564,13 @@ NFA::SubAutomaton NFA::parseQualifier(const char *&expr, SubAutomaton autom)
     case '+':
         autom = parsePlus(expr, autom);
         break;
+    case '{':
+        autom = parseRepeat(expr, autom);
+        break;
     default:
         return autom;
     }
-    if (*expr == '?' || *expr == '*' || *expr == '+') {
+    if (*expr == '?' || *expr == '*' || *expr == '+' || *expr == '{') {
         error() << "qualifier mustn't be after another qualifier\n";
         std::exit(1);
     }
@@ -457,67 +585,176 @@ NFA::SubAutomaton NFA::parseQuestion(const char *&expr, SubAutomaton autom)
 }
 
 NFA::SubAutomaton NFA::parseStar(const char *&expr, SubAutomaton autom)
+{
+    ++expr;
+    return makeStar(autom);
+}
+
+NFA::SubAutomaton NFA::parsePlus(const char *&expr, SubAutomaton autom)
+{
+    ++expr;
+    return makeRepeat(autom, 1, RepeatUnbounded);
+}
+
+NFA::SubAutomaton NFA::parseRepeat(const char *&expr, SubAutomaton autom)
+{
+    unsigned min, max;
+    parseRepeatBounds(expr, min, max);
+    size_t numStates = Storage.size();
+    autom = makeRepeat(autom, min, max);
+    NumRepeatStates += Storage.size() - numStates;
+    return autom;
+}
+
+NFA::SubAutomaton NFA::makeStar(SubAutomaton autom)
 {
     auto *startState = makeState();
     auto *lastState = makeState();
     startState->connectTo(lastState, Epsilon);
     autom.second->connectTo(lastState, Epsilon);
     lastState->connectTo(autom.first, Epsilon);
-    ++expr;
     return {startState, lastState};
 }
 
-NFA::SubAutomaton NFA::parsePlus(const char *&expr, SubAutomaton autom)
+NFA::SubAutomaton NFA::makeRepeat(SubAutomaton autom, unsigned min, unsigned max)
 {
-    auto copyAutom = cloneSubAutomaton(autom);
-    auto starAutom = parseStar(expr, copyAutom); // this method's already advanced expr
-    starAutom.second->connectTo(copyAutom.first, Epsilon);
-    return {starAutom.first, copyAutom.second};
+    if (max == 0) {
+        // the sub-automaton is left unreachable, and the NFA reduction drops it
+        auto *state = makeState();
+        return {state, state};
+    }
+    if (min == 0 && max == RepeatUnbounded)
+        return makeStar(autom);
+
+    // The copies are chained one after another. The start state of a sub-automaton has no incoming
+    // edges, so the last copy of an unbounded repetition loops with an epsilon edge back to its
+    // start, and no extra copy is needed for the loop. Copies after the minimal number can be
+    // skipped with epsilon edges to the common last state.
+    unsigned numCopies = max == RepeatUnbounded ? min : max;
+    SmallVector<SubAutomaton, 8> copies = {autom};
+    if (numCopies > 1) {
+        SubAutomatonPattern pattern = makePattern(autom);
+        for (unsigned i = 1; i < numCopies; i++) {
+            copies.push_back(instantiatePattern(pattern));
+            copies[i - 1].second->connectTo(copies[i].first, Epsilon);
+        }
+    }
+    if (max == RepeatUnbounded) {
+        copies.back().second->connectTo(copies.back().first, Epsilon);
+        return {copies.front().first, copies.back().second};
+    }
+    if (min == max)
+        return {copies.front().first, copies.back().second};
+
+    auto *lastState = makeState();
+    copies.back().second->connectTo(lastState, Epsilon);
+    for (unsigned i = min; i < numCopies; i++)
+        copies[i].first->connectTo(lastState, Epsilon);
+    return {copies.front().first, lastState};
 }
 
-NFA::SubAutomaton NFA::cloneSubAutomaton(SubAutomaton autom)
+NFA::SubAutomatonPattern NFA::makePattern(SubAutomaton autom) const
 {
-    DenseMap<const State *, State *> map;
-    auto rec = [&map, this](const State *state, auto &recRef) {
-        if (map.find(state) != map.end())
-            return;
-        auto *newState = makeState();
-        map[state] = newState;
-        for (auto &edge : state->getEdges())
-            recRef(edge.getTarget(), recRef);
-    };
-    rec(autom.first, rec);
-
-    for (auto &item : map) {
-        auto *origState = item.first;
-        auto *newState = item.second;
-        for (auto &edge : origState->getEdges()) {
-            auto *newTargetState = map[edge.getTarget()];
-            newState->connectTo(newTargetState, edge.getSymbol());
+    SubAutomatonPattern pattern;
+    DenseMap<const State *, unsigned> localIDs;
+    SmallVector<const State *, 16> worklist = {autom.first};
+    localIDs[autom.first] = 0;
+    if (autom.second != autom.first) {
+        localIDs[autom.second] = 1;
+        worklist.push_back(autom.second);
+    }
+    for (unsigned i = 0; i < worklist.size(); i++) {
+        for (const Edge &edge : worklist[i]->getEdges()) {
+            auto inserted = localIDs.insert({edge.getTarget(), worklist.size()});
+            if (inserted.second)
+                worklist.push_back(edge.getTarget());
+            pattern.Edges.emplace_back(i, inserted.first->second, edge.getLo(), edge.getHi());
         }
     }
-    return {map[autom.first], map[autom.second]};
+    pattern.NumStates = worklist.size();
+    pattern.LastState = localIDs[autom.second];
+    return pattern;
 }
 
-/// This function looks for new state set, an equivalent of the next DFA state for the edge
-/// \p symbol.
-static StateSet findDFAState(const StateSet &states, Symbol symbol)
+NFA::SubAutomaton NFA::instantiatePattern(const SubAutomatonPattern &pattern)
 {
-    StateSet newStates;
-    for (const auto &state : states) {
-        for (const auto &edge : state->getEdges()) {
-            if (edge.getSymbol() == symbol) {
-                auto closure = edge.getTarget()->getEspClosure();
-                newStates.insert(closure.begin(), closure.end());
-            }
+    assert(pattern.LastState < pattern.NumStates && "malformed pattern");
+    SmallVector<State *, 16> states;
+    for (unsigned i = 0; i < pattern.NumStates; i++)
+        states.push_back(makeState());
+    for (const auto &edge : pattern.Edges)
+        states[std::get<0>(edge)]->connectTo(states[std::get<1>(edge)], std::get<2>(edge),
+                                             std::get<3>(edge));
+    return {states[0], states[pattern.LastState]};
+}
+
+namespace {
+
+/// Range of symbols leading from a set of NFA states to another set of NFA states.
+struct RangeTarget {
+    Symbol Lo;
+    Symbol Hi;
+    StateSet Targets;
+};
+
+} // namespace
+
+/// Splits all the symbol ranges of non-epsilon edges of \p states into disjoint ranges. Every
+/// resulting range leads to the same set of NFA states (including epsilon closures) for all its
+/// symbols, and neighbour ranges with the same target sets are merged.
+///
+/// It is done with one sweep through the sorted bounds of the edges' ranges instead of a pass for
+/// every possible symbol.
+static void partitionRanges(const StateSet &states, SmallVectorImpl<RangeTarget> &result,
+                            DenseMap<const State *, StateSet> &closures)
+{
+    // (symbol, is range start, target); range ends are stored as Hi + 1
+    SmallVector<std::tuple<Symbol, bool, const State *>, 16> bounds;
+    for (const State *state : states) {
+        for (const Edge &edge : state->getEdges()) {
+            if (edge.isEpsilon())
+                continue;
+            bounds.emplace_back(edge.getLo(), true, edge.getTarget());
+            bounds.emplace_back(edge.getHi() + 1, false, edge.getTarget());
+        }
+    }
+    llvm::sort(bounds, [](const auto &left, const auto &right) {
+        return std::get<0>(left) < std::get<0>(right);
+    });
+
+    DenseMap<const State *, unsigned> active; // number of active ranges leading to the target
+    for (size_t i = 0, e = bounds.size(); i < e;) {
+        Symbol lo = std::get<0>(bounds[i]);
+        for (; i < e && std::get<0>(bounds[i]) == lo; ++i) {
+            const State *target = std::get<2>(bounds[i]);
+            if (std::get<1>(bounds[i]))
+                ++active[target];
+            else if (--active[target] == 0)
+                active.erase(target);
+        }
+        if (active.empty())
+            continue;
+        assert(i < e && "every range must be closed");
+        Symbol hi = std::get<0>(bounds[i]) - 1;
+
+        StateSet targets;
+        for (const auto &item : active) {
+            auto iter = closures.find(item.first);
+            if (iter == closures.end())
+                iter = closures.insert({item.first, item.first->getEspClosure()}).first;
+            targets.insert(iter->second.begin(), iter->second.end());
         }
+        if (!result.empty() && result.back().Hi + 1 == lo && result.back().Targets == targets)
+            result.back().Hi = hi;
+        else
+            result.push_back({lo, hi, std::move(targets)});
     }
-    return newStates;
 }
 
 NFA NFA::buildDFA() const
 {
     std::map<const StateSet, State *> convTable;
+    DenseMap<const State *, StateSet> closures;
     NFA dfa;
     dfa.Storage.pop_back(); // by default NFA contains the start state, but here we don't need it
     StateSet setQ0 = getStartState()->getEspClosure();
@@ -538,17 +775,11 @@ NFA NFA::buildDFA() const
         }
         convTable[set] = newState;
 
-        SmallSet<Symbol, 1> symbols; // in generated DFA there are many one-edge-states
-        for (auto state : set)
-            for (const Edge &edge : state->getEdges())
-                if (!edge.isEpsilon())
-                    symbols.insert(edge.getSymbol());
-
-        for (auto symbol : symbols) {
-            auto targetSet = findDFAState(set, symbol);
-            assert(!targetSet.empty() && "target set musn't be empty");
-            auto targetState = convertRef(targetSet, convertRef);
-            newState->connectTo(targetState, symbol);
+        SmallVector<RangeTarget, 1> ranges; // in generated DFA there are many one-edge-states
+        partitionRanges(set, ranges, closures);
+        for (const RangeTarget &range : ranges) {
+            auto targetState = convertRef(range.Targets, convertRef);
+            newState->connectTo(targetState, range.Lo, range.Hi);
         }
         return newState;
     };
@@ -557,6 +788,142 @@ NFA NFA::buildDFA() const
     return dfa;
 }
 
+namespace {
+
+/// Edge of a reduced automaton: the closed range of symbols and the index of the target.
+using ReducedEdge = std::tuple<Symbol, Symbol, unsigned>;
+
+} // namespace
+
+/// Returns \p edges with targets replaced by their classes, in a canonical form: the symbols of
+/// every target class are merged into disjoint maximal ranges, and the ranges are sorted.
+static std::vector<ReducedEdge> normalizeEdges(ArrayRef<ReducedEdge> edges,
+                                               ArrayRef<unsigned> classes)
+{
+    // (class, lo, hi) to merge ranges of the same class
+    std::vector<ReducedEdge> result;
+    for (const ReducedEdge &edge : edges)
+        result.emplace_back(classes[std::get<2>(edge)], std::get<0>(edge), std::get<1>(edge));
+    llvm::sort(result);
+
+    std::vector<ReducedEdge> merged;
+    for (const ReducedEdge &edge : result) {
+        if (!merged.empty() && std::get<0>(merged.back()) == std::get<0>(edge)
+            && std::get<1>(edge) <= std::get<2>(merged.back()) + 1) {
+            std::get<2>(merged.back()) = std::max(std::get<2>(merged.back()), std::get<2>(edge));
+            continue;
+        }
+        merged.push_back(edge);
+    }
+    for (ReducedEdge &edge : merged)
+        edge = ReducedEdge(std::get<1>(edge), std::get<2>(edge), std::get<0>(edge));
+    llvm::sort(merged);
+    return merged;
+}
+
+NFA NFA::buildReducedNFA() const
+{
+    assert(ModeStartIDs.empty() && NextModes.empty() && CanonicalIDs.empty()
+           && "modes must be reduced before joining them");
+
+    // Epsilon elimination. A state gets the non-epsilon edges of its epsilon closure and the kind
+    // of the earliest terminal state in the closure. Only states reachable from the start state
+    // by the new edges are visited.
+    size_t numStates = Storage.size();
+    SmallVector<tok::TokenKind, 0> kinds(numStates, tok::unknown);
+    SmallVector<SmallVector<ReducedEdge, 2>, 0> edges(numStates);
+    BitVector reachable(numStates);
+    SmallVector<StateID, 0> worklist = {Q0->getID()};
+    reachable.set(Q0->getID());
+    while (!worklist.empty()) {
+        StateID id = worklist.pop_back_val();
+        StateID minTerminalID = numStates;
+        for (const State *state : Storage[id]->getEspClosure()) {
+            if (state->isTerminal() && state->getID() < minTerminalID) {
+                minTerminalID = state->getID();
+                kinds[id] = state->getKind();
+            }
+            for (const Edge &edge : state->getEdges()) {
+                if (edge.isEpsilon())
+                    continue;
+                StateID targetID = edge.getTarget()->getID();
+                edges[id].emplace_back(edge.getLo(), edge.getHi(), targetID);
+                if (!reachable.test(targetID)) {
+                    reachable.set(targetID);
+                    worklist.push_back(targetID);
+                }
+            }
+        }
+    }
+
+    // States that can't reach a terminal state are useless for the lexer.
+    SmallVector<SmallVector<StateID, 2>, 0> sources(numStates);
+    BitVector useful(numStates);
+    for (StateID id : reachable.set_bits()) {
+        for (const ReducedEdge &edge : edges[id])
+            sources[std::get<2>(edge)].push_back(id);
+        if (kinds[id] != tok::unknown) {
+            useful.set(id);
+            worklist.push_back(id);
+        }
+    }
+    while (!worklist.empty())
+        for (StateID sourceID : sources[worklist.pop_back_val()])
+            if (!useful.test(sourceID)) {
+                useful.set(sourceID);
+                worklist.push_back(sourceID);
+            }
+    useful.set(Q0->getID());
+
+    SmallVector<StateID, 0> keptIDs;
+    for (StateID id : useful.set_bits()) {
+        keptIDs.push_back(id);
+        llvm::erase_if(edges[id], [&useful](const ReducedEdge &edge) {
+            return !useful.test(std::get<2>(edge));
+        });
+    }
+
+    // Partition refinement. States are split by their kinds first, and then by the classes their
+    // edges lead to, until no class is split. Classes are numbered in order of their earliest
+    // states, so the lesser ID of a terminal state still means the higher priority.
+    SmallVector<unsigned, 0> classes(numStates);
+    std::map<tok::TokenKind, unsigned> kindClasses;
+    for (StateID id : keptIDs)
+        classes[id] = kindClasses.emplace(kinds[id], kindClasses.size()).first->second;
+    size_t numClasses = kindClasses.size();
+    while (true) {
+        std::map<std::pair<unsigned, std::vector<ReducedEdge>>, unsigned> signatures;
+        SmallVector<unsigned, 0> newClasses(numStates);
+        for (StateID id : keptIDs) {
+            auto signature = std::make_pair(classes[id], normalizeEdges(edges[id], classes));
+            newClasses[id] =
+                signatures.emplace(std::move(signature), signatures.size()).first->second;
+        }
+        bool isStable = signatures.size() == numClasses;
+        numClasses = signatures.size();
+        classes = std::move(newClasses);
+        if (isStable)
+            break;
+    }
+
+    NFA reduced;
+    reduced.Storage.pop_back();
+    SmallVector<StateID, 0> representatives; // the earliest state of every class
+    for (StateID id : keptIDs) {
+        if (classes[id] < representatives.size())
+            continue;
+        representatives.push_back(id);
+        reduced.makeState(kinds[id]);
+    }
+    for (unsigned classID = 0; classID < numClasses; classID++)
+        for (const ReducedEdge &edge : normalizeEdges(edges[representatives[classID]], classes))
+            reduced.Storage[classID]->connectTo(reduced.Storage[std::get<2>(edge)],
+                                                std::get<0>(edge), std::get<1>(edge));
+    reduced.Q0 = reduced.Storage[classes[Q0->getID()]];
+    reduced.IsDFA = IsDFA;
+    return reduced;
+}
+
 NFA NFA::buildMinimizedDFA() const
 {
     if (!IsDFA) {
@@ -565,10 +932,13 @@ NFA NFA::buildMinimizedDFA() const
     }
 
     SmallVector<BitVector, 0> distinguishTable;
+    bool isParallel = hardware_concurrency(NumThreads).compute_thread_count() > 1;
     if (MinimAlgo == MA_O2)
-        distinguishTable = buildDistinguishTableO2();
+        distinguishTable =
+            isParallel ? buildDistinguishTableO2Parallel() : buildDistinguishTableO2();
     else
-        distinguishTable = buildDistinguishTableO4();
+        distinguishTable =
+            isParallel ? buildDistinguishTableO4Parallel() : buildDistinguishTableO4();
 
 #define DEBUG_TYPE "disting-table"
     LLVM_DEBUG(dumpDistinguishTable(distinguishTable, llvm::errs()));
@@ -589,14 +959,14 @@ NFA NFA::buildMinimizedDFA() const
             continue;
 
         StateSet group;
-        group.insert(Storage[id].get());
+        group.insert(Storage[id]);
         checkedStates[id] = true;
         for (StateID nextID = 0; nextID < e; nextID++) {
             if (checkedStates[nextID])
                 continue;
 
             if (!areDistinguishable(distinguishTable, id, nextID)) {
-                group.insert(Storage[nextID].get());
+                group.insert(Storage[nextID]);
                 checkedStates[nextID] = true;
             }
         }
@@ -614,29 +984,182 @@ NFA NFA::buildMinimizedDFA() const
     }
     assert(minDfa.Q0);
 
-    // Build edges between new states
+    // Build edges between new states. All the states of a group are equivalent, so edges of any
+    // of them can be used. Neighbour ranges leading to one group are merged.
     for (auto &item : new2old) {
         State *newState = item.first;
-        auto &group = item.second;
-
-        BitVector addedSymbols;
-        addedSymbols.resize(256, false);
-        for (const auto *oldState : group) {
-            for (const auto &edge : oldState->getEdges()) {
-                if (addedSymbols[edge.getSymbol()])
-                    break;
-
-                const State *target = old2new[edge.getTarget()];
-                newState->connectTo(target, edge.getSymbol());
-                addedSymbols[edge.getSymbol()] = true;
-            }
+        const State *oldState = *item.second.begin();
+
+        SmallVector<Edge, 8> edges;
+        for (const auto &edge : oldState->getEdges())
+            edges.push_back(Edge(edge.getLo(), edge.getHi(), old2new[edge.getTarget()]));
+        llvm::sort(edges, [](const Edge &l, const Edge &r) { return l.getLo() < r.getLo(); });
+        for (size_t i = 0, e = edges.size(); i < e;) {
+            Symbol lo = edges[i].getLo();
+            Symbol hi = edges[i].getHi();
+            const State *target = edges[i].getTarget();
+            for (++i; i < e && edges[i].getLo() == hi + 1 && edges[i].getTarget() == target; ++i)
+                hi = edges[i].getHi();
+            newState->connectTo(target, lo, hi);
         }
     }
 
     return minDfa;
 }
 
-bool NFA::generateCppImpl(StringRef filename, NFA::GeneratingMode mode) const
+NFA NFA::joinModeAutomata(ArrayRef<NFA> modeAutomata, ArrayRef<unsigned> nextModes)
+{
+    assert(!modeAutomata.empty() && "there must be at least one mode");
+
+    NFA joined;
+    joined.IsDFA = true;
+    joined.Storage.pop_back();
+    bool changesMode = false;
+    for (unsigned mode = 0; mode < modeAutomata.size(); mode++) {
+        const NFA &autom = modeAutomata[mode];
+        assert(autom.getNumModes() == 1 && "expected automaton of one mode");
+
+        joined.IsDFA &= autom.IsDFA;
+        StateID offset = joined.Storage.size();
+        for (const State *state : autom.Storage) {
+            joined.makeState(state->getKind());
+            unsigned nextMode = state->isTerminal() && state->getKind() < nextModes.size()
+                                    ? nextModes[state->getKind()]
+                                    : modeAutomata.size();
+            changesMode |= nextMode < modeAutomata.size();
+            joined.NextModes.push_back(nextMode < modeAutomata.size() ? nextMode : mode);
+        }
+        for (const State *state : autom.Storage)
+            for (const Edge &edge : state->getEdges())
+                joined.Storage[offset + state->getID()]->connectTo(
+                    joined.Storage[offset + edge.getTarget()->getID()], edge.getLo(),
+                    edge.getHi());
+        joined.ModeStartIDs.push_back(offset + autom.Q0->getID());
+    }
+    joined.Q0 = joined.Storage[joined.ModeStartIDs[0]];
+    if (modeAutomata.size() == 1)
+        joined.ModeStartIDs.clear();
+    if (!changesMode)
+        joined.NextModes.clear();
+    return joined;
+}
+
+NFA NFA::buildRenumberedDFA(ArrayRef<uint64_t> weights) const
+{
+    assert(IsDFA && "It's expected that the NFA meets DFA requirements");
+
+    SmallVector<StateID, 0> order;
+    for (StateID id = 0; id < Storage.size(); id++)
+        order.push_back(id);
+    std::stable_sort(order.begin(), order.end(), [&](StateID l, StateID r) {
+        return weights[getCanonicalID(l)] > weights[getCanonicalID(r)];
+    });
+
+    NFA dfa;
+    dfa.IsDFA = true;
+    dfa.Storage.pop_back();
+    SmallVector<State *, 0> old2new(Storage.size());
+    for (StateID id : order) {
+        old2new[id] = dfa.makeState(Storage[id]->getKind());
+        dfa.CanonicalIDs.push_back(getCanonicalID(id));
+        if (!NextModes.empty())
+            dfa.NextModes.push_back(NextModes[id]);
+    }
+    for (StateID id = 0; id < Storage.size(); id++)
+        for (const Edge &edge : Storage[id]->getEdges())
+            old2new[id]->connectTo(old2new[edge.getTarget()->getID()], edge.getLo(), edge.getHi());
+    dfa.Q0 = old2new[Q0->getID()];
+    for (StateID id : ModeStartIDs)
+        dfa.ModeStartIDs.push_back(old2new[id]->getID());
+    return dfa;
+}
+
+uint32_t NFA::getCanonicalHash() const
+{
+    assert(IsDFA && "It's expected that the NFA meets DFA requirements");
+
+    SmallVector<const State *, 0> canonicalStates(Storage.size());
+    for (const State *state : Storage)
+        canonicalStates[getCanonicalID(state->getID())] = state;
+
+    // the DFA in the format of \c write, but with canonical IDs
+    std::string text;
+    raw_string_ostream out(text);
+    out << Storage.size() << " " << getCanonicalID(Q0->getID()) << "\n";
+    for (const State *state : canonicalStates) {
+        out << state->getKind() << " " << (NextModes.empty() ? 0 : NextModes[state->getID()]);
+        for (const Edge &edge : state->getEdges())
+            out << " " << edge.getLo() << " " << edge.getHi() << " "
+                << getCanonicalID(edge.getTarget()->getID());
+        out << "\n";
+    }
+    for (unsigned mode = 0; mode < getNumModes(); mode++)
+        out << " " << getCanonicalID(getModeStartID(mode));
+    out.flush();
+
+    MD5 hash;
+    hash.update(text);
+    MD5::MD5Result result;
+    hash.final(result);
+    return (uint32_t)result.low();
+}
+
+bool NFA::isEquivalentDFA(const NFA &other) const
+{
+    assert(IsDFA && other.IsDFA && "It's expected that the NFAs meet DFA requirements");
+    if (getNumModes() != other.getNumModes())
+        return false;
+
+    // The DFAs are run together from the start states of every mode. A missing transition leads
+    // to the invalid state, which is equal to the number of states.
+    StateID invalidID = getNumStates(), otherInvalidID = other.getNumStates();
+    auto getTargets = [](const State *state, StateID invalidID, StateID (&targets)[256]) {
+        std::fill(std::begin(targets), std::end(targets), invalidID);
+        for (const Edge &edge : state->getEdges())
+            for (Symbol symbol = edge.getLo(); symbol <= edge.getHi(); symbol++)
+                targets[symbol] = edge.getTarget()->getID();
+    };
+    DenseSet<std::pair<StateID, StateID>> visited;
+    SmallVector<std::tuple<StateID, StateID, unsigned>, 0> worklist;
+    for (unsigned mode = 0; mode < getNumModes(); mode++) {
+        auto pair = std::make_pair(getModeStartID(mode), other.getModeStartID(mode));
+        if (visited.insert(pair).second)
+            worklist.emplace_back(pair.first, pair.second, mode);
+    }
+
+    StateID targets[256], otherTargets[256];
+    while (!worklist.empty()) {
+        StateID id, otherID;
+        unsigned mode;
+        std::tie(id, otherID, mode) = worklist.pop_back_val();
+        if (id == invalidID || otherID == otherInvalidID)
+            return false; // only one of the DFAs fails, the other can go on
+        const State *state = Storage[id];
+        const State *otherState = other.Storage[otherID];
+        if (state->getKind() != otherState->getKind())
+            return false;
+        if (state->isTerminal()) {
+            unsigned nextMode = NextModes.empty() ? mode : NextModes[id];
+            unsigned otherNextMode = other.NextModes.empty() ? mode : other.NextModes[otherID];
+            if (nextMode != otherNextMode)
+                return false;
+        }
+
+        getTargets(state, invalidID, targets);
+        getTargets(otherState, otherInvalidID, otherTargets);
+        for (unsigned symbol = 0; symbol <= MaxSymbolValue; symbol++) {
+            auto pair = std::make_pair(targets[symbol], otherTargets[symbol]);
+            if (pair.first == invalidID && pair.second == otherInvalidID)
+                continue;
+            if (visited.insert(pair).second)
+                worklist.emplace_back(pair.first, pair.second, mode);
+        }
+    }
+    return true;
+}
+
+bool NFA::generateCppImpl(StringRef filename, NFA::GeneratingMode mode, StringRef prefix,
+                          StringRef tablesBasename) const
 {
     if (!IsDFA) {
         error() << "you are trying generate trasitive table for non DFA\n";
@@ -653,15 +1176,19 @@ bool NFA::generateCppImpl(StringRef filename, NFA::GeneratingMode mode) const
         return false;
     }
 
+    SmallVector<BinaryTable, 3> tables;
+    if (!tablesBasename.empty()) {
+        tables = buildBinaryTables(mode);
+        if (!writeBinaryTables(tables, tablesBasename, prefix))
+            return false;
+    }
+
     printHeadComment(out, "\n");
-    printConstants(out, "\n\n");
-    if (mode == GM_Table)
-        printTransTableFunction(out, "\n\n");
-    else if (mode == GM_Switch)
-        printTransSwitchFunction(out, "\n\n");
-    else
-        llvm_unreachable("Unknown mode of transitive function generating.");
-    printTerminalFunction(out, "\n");
+    printConstants(out, prefix, "\n\n");
+    if (!tables.empty())
+        printBinaryTableDecls(tables, out, prefix, "\n");
+    printDFAStruct(out, mode, prefix, tables, "\n\n");
+    printWrapperFunctions(out, prefix, "\n");
 
     return true;
 }
@@ -671,26 +1198,45 @@ raw_ostream &NFA::print(raw_ostream &out) const
     for (const auto &state : Storage) {
         out << *state << "\n";
         for (const auto &edge : state->getEdges()) {
-            out << " |- '";
+            out << " |- ";
+            auto printSymbol = [&out](Symbol symbol) {
+                char c = symbol;
+                bool useHexEscapes = c & 0x80 ? false : true;
+                out << "'";
+                out.write_escaped(StringRef(&c, 1), useHexEscapes);
+                out << "'";
+            };
             if (edge.isEpsilon()) {
-                out << "Eps";
+                out << "'Eps'";
             }
             else {
-                char c = edge.getSymbol();
-                bool useHexEscapes = c & 0x80 ? false : true;
-                out.write_escaped(StringRef(&c, 1), useHexEscapes);
+                printSymbol(edge.getLo());
+                if (edge.getLo() != edge.getHi()) {
+                    out << "-";
+                    printSymbol(edge.getHi());
+                }
             }
-            out << "' - " << *edge.getTarget() << "\n";
+            out << " - " << *edge.getTarget() << "\n";
         }
     }
     return out;
 }
 
+size_t NFA::getNumEdges() const
+{
+    size_t numEdges = 0;
+    for (const auto &state : Storage)
+        numEdges += state->getEdges().size();
+    return numEdges;
+}
+
 State *NFA::makeState(tok::TokenKind kind)
 {
-    auto *newState = new State((StateID)Storage.size(), kind);
-    Storage.push_back(unique_ptr<State>(newState));
-    return Storage.back().get();
+    static_assert(std::is_trivially_destructible<State>::value,
+                  "states are freed without calling destructors");
+    auto *newState = new (Allocator->Allocate<State>()) State(Storage.size(), *Allocator, kind);
+    Storage.push_back(newState);
+    return newState;
 }
 
 SmallVector<BitVector, 0>
@@ -703,9 +1249,9 @@ NFA::initDistinguishTableO2(std::queue<std::pair<StateID, StateID>> &queue) cons
         distinTable[i].resize(e, false);
 
     for (StateID i = 0, e = Storage.size(); i < e; i++) {
-        auto *st1 = Storage[i].get();
+        auto *st1 = Storage[i];
         for (StateID j = i + 1; j < e; j++) {
-            auto *st2 = Storage[j].get();
+            auto *st2 = Storage[j];
             if ((st1->isTerminal() && !st2->isTerminal())
                 || (!st1->isTerminal() && st2->isTerminal())) {
                 distinTable[i][j] = true;
@@ -757,6 +1303,60 @@ SmallVector<BitVector, 0> NFA::buildDistinguishTableO2() const
     return distinTable;
 }
 
+SmallVector<BitVector, 0> NFA::buildDistinguishTableO2Parallel() const
+{
+    assert(IsDFA && "can't make equivalent table for non DFA");
+
+    std::queue<std::pair<StateID, StateID>> queue;
+    auto distinTable = initDistinguishTableO2(queue);
+    auto reverseTable = buildReverseTransitiveTable();
+
+    SmallVector<std::pair<StateID, StateID>, 0> generation;
+    generation.reserve(queue.size());
+    for (; !queue.empty(); queue.pop())
+        generation.push_back(queue.front());
+
+    ThreadPoolStrategy strategy = hardware_concurrency(NumThreads);
+    unsigned numShards = strategy.compute_thread_count();
+    ThreadPool pool(strategy);
+    SmallVector<SmallVector<std::pair<StateID, StateID>, 0>, 0> found(numShards);
+    while (!generation.empty()) {
+        for (unsigned shard = 0; shard < numShards; shard++) {
+            pool.async([&, shard] {
+                auto &result = found[shard];
+                for (size_t k = shard, e = generation.size(); k < e; k += numShards) {
+                    auto curPair = generation[k];
+                    for (Symbol c = 0; c <= MaxSymbolValue; c++) {
+                        for (StateID firstID : reverseTable[curPair.first][c]) {
+                            for (StateID secondID : reverseTable[curPair.second][c]) {
+                                if (firstID == secondID)
+                                    continue;
+                                std::pair<StateID, StateID> pair = std::minmax(firstID, secondID);
+                                if (!distinTable[pair.first][pair.second])
+                                    result.push_back(pair);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+        pool.wait();
+
+        // the table is changed only here, when no one reads it
+        generation.clear();
+        for (auto &result : found) {
+            for (auto pair : result) {
+                if (!distinTable[pair.first][pair.second]) {
+                    distinTable[pair.first][pair.second] = true;
+                    generation.push_back(pair);
+                }
+            }
+            result.clear();
+        }
+    }
+    return distinTable;
+}
+
 SmallVector<BitVector, 0> NFA::initDistinguishTableO4() const
 {
     SmallVector<BitVector, 0> distinTable;
@@ -766,8 +1366,8 @@ SmallVector<BitVector, 0> NFA::initDistinguishTableO4() const
 
     for (unsigned i = 0, e = Storage.size(); i < e; i++) {
         for (unsigned j = i + 1; j < e; j++) {
-            auto *st1 = Storage[i].get();
-            auto *st2 = Storage[j].get();
+            auto *st1 = Storage[i];
+            auto *st2 = Storage[j];
             if ((st1->isTerminal() && !st2->isTerminal())
                 || (!st1->isTerminal() && st2->isTerminal())) {
                 distinTable[i][j] = true;
@@ -797,36 +1397,51 @@ SmallVector<BitVector, 0> NFA::buildDistinguishTableO4() const
                 if (distinTable[i][j])
                     continue;
 
-                for (Symbol c = 0u; c <= MaxSymbolValue; c++) {
-                    StateID nextIid = transTable[i][c];
-                    StateID nextJid = transTable[j][c];
-                    if (nextIid == InvalidID) {
-                        if (nextJid == InvalidID) {
+                if (haveDistinguishableTargets(distinTable, transTable, i, j, InvalidID)) {
+                    distinTable[i][j] = true;
+                    isUpdated = true;
+                }
+            }
+        }
+    } while (isUpdated);
+
+    return distinTable;
+}
+
+SmallVector<BitVector, 0> NFA::buildDistinguishTableO4Parallel() const
+{
+    assert(IsDFA && "can't make equivalent table for non DFA");
+
+    auto distinTable = initDistinguishTableO4();
+    const StateID InvalidID = Storage.size();
+    auto transTable = buildTransitiveTable();
+    ThreadPoolStrategy strategy = hardware_concurrency(NumThreads);
+    unsigned numShards = strategy.compute_thread_count();
+    ThreadPool pool(strategy);
+    std::atomic<bool> isUpdated;
+    do {
+        isUpdated = false;
+        auto nextTable = distinTable;
+        for (unsigned shard = 0; shard < numShards; shard++) {
+            // rows are interleaved because the upper triangle rows have different lengths
+            pool.async([&, shard] {
+                bool isShardUpdated = false;
+                for (StateID i = shard, e = Storage.size(); i < e; i += numShards) {
+                    for (StateID j = i + 1; j < e; j++) {
+                        if (distinTable[i][j])
                             continue;
-                        }
-                        else {
-                            distinTable[i][j] = true;
-                            isUpdated = true;
-                            break;
-                        }
-                    }
-                    else {
-                        if (nextJid == InvalidID) {
-                            distinTable[i][j] = true;
-                            isUpdated = true;
-                            break;
-                        }
-                        else {
-                            if (areDistinguishable(distinTable, nextIid, nextJid)) {
-                                distinTable[i][j] = true;
-                                isUpdated = true;
-                                break;
-                            }
+                        if (haveDistinguishableTargets(distinTable, transTable, i, j, InvalidID)) {
+                            nextTable[i][j] = true;
+                            isShardUpdated = true;
                         }
                     }
                 }
-            }
+                if (isShardUpdated)
+                    isUpdated = true;
+            });
         }
+        pool.wait();
+        distinTable = std::move(nextTable);
     } while (isUpdated);
 
     return distinTable;
@@ -857,9 +1472,10 @@ NFA::TransitiveTable NFA::buildTransitiveTable() const
         row.resize(TransTableRowSize, INVALID_ID);
 
     for (StateID id = 0; id < Storage.size(); id++) {
-        const auto *state = Storage[id].get();
+        const auto *state = Storage[id];
         for (const auto &edge : state->getEdges())
-            transTable[id][edge.getSymbol()] = edge.getTarget()->getID();
+            for (Symbol c = edge.getLo(); c <= edge.getHi(); c++)
+                transTable[id][c] = edge.getTarget()->getID();
     }
     return transTable;
 }
@@ -894,6 +1510,19 @@ NFA::ReverseTable NFA::buildReverseTransitiveTable() const
     return reverseTable;
 }
 
+/// Returns the flag that marks IDs of accepting states in transitions of the generated DFA. It is
+/// the high bit of the smallest cell type that keeps \p numStates states plus invalid one below it.
+static uint64_t getAcceptFlag(size_t numStates)
+{
+    if (numStates < 0x80u)
+        return 0x80u;
+    if (numStates < 0x8000u)
+        return 0x8000u;
+    if (numStates < 0x80000000u)
+        return 0x80000000u;
+    llvm_unreachable("Number of states is too big. Now only uint32_t is supported");
+}
+
 /// Returns type required for containing of \p size states plus invalid one.
 static const char *getTypeBySize(size_t size)
 {
@@ -906,42 +1535,332 @@ static const char *getTypeBySize(size_t size)
     llvm_unreachable("Number of states is too big. Now only uint32_t is supported");
 }
 
+/// Returns size in bytes of the type returned by \p getTypeBySize.
+static unsigned getWidthBySize(size_t size)
+{
+    if (size <= 0xffu)
+        return 1;
+    if (size <= 0xffffu)
+        return 2;
+    return 4;
+}
+
+static void appendLittleEndian(std::string &data, uint64_t value, unsigned width)
+{
+    for (unsigned i = 0; i < width; i++)
+        data += (char)(value >> (8 * i));
+}
+
+StateID NFA::encodeTransition(StateID id) const
+{
+    if (id == Storage.size() || !Storage[id]->isTerminal())
+        return id;
+    return id | getAcceptFlag(Storage.size());
+}
+
+const char *NFA::getTransitionType() const
+{
+    return getTypeBySize(getAcceptFlag(Storage.size()) | Storage.size());
+}
+
 void NFA::printTransitiveTable(const TransitiveTable &table, raw_ostream &out, int indent) const
 {
     SmallString<16> indention;
     for (int i = 0; i < indent; i++)
         indention += ' ';
 
-    const char *typeStr = getTypeBySize(table.size());
-    out << indention << "static const " << typeStr;
+    out << indention << "static constexpr " << getTransitionType();
     out << " TransitiveTable[" << table.size() << "][" << TransTableRowSize << "] = {\n";
     for (size_t i = 0; i < table.size(); i++) {
         const auto &row = table[i];
         out << indention << "    {";
         for (size_t j = 0; j < row.size(); j++)
-            out << row[j] << "u" << (j + 1 == row.size() ? "" : ", ");
+            out << encodeTransition(row[j]) << "u" << (j + 1 == row.size() ? "" : ", ");
         out << "}" << (i + 1 == table.size() ? "\n" : ",\n");
     }
     out << indention << "};\n";
 }
 
+bool NFA::fitsShuffleTable() const
+{
+    // the invalid state takes a lane too
+    return Storage.size() < ShuffleWidth;
+}
+
+SmallVector<std::array<uint8_t, NFA::ShuffleWidth>, 0> NFA::buildShuffleTable() const
+{
+    assert(fitsShuffleTable() && "too many states for the shuffle table");
+
+    // the row of a symbol maps every state to its target, so one byte shuffle of the row with the
+    // current state in all the lanes makes one transition
+    TransitiveTable table = buildTransitiveTable();
+    const StateID invalidID = Storage.size();
+    SmallVector<std::array<uint8_t, ShuffleWidth>, 0> shuffleTable(TransTableRowSize);
+    for (unsigned symbol = 0; symbol < TransTableRowSize; symbol++) {
+        for (StateID id = 0; id < ShuffleWidth; id++) {
+            StateID target = id < table.size() ? table[id][symbol] : invalidID;
+            unsigned cell = target;
+            if (target != invalidID && Storage[target]->isTerminal())
+                cell |= ShuffleAcceptFlag;
+            shuffleTable[symbol][id] = cell;
+        }
+    }
+    return shuffleTable;
+}
+
+void NFA::printShuffleTable(raw_ostream &out, int indent) const
+{
+    SmallString<16> indention;
+    for (int i = 0; i < indent; i++)
+        indention += ' ';
+
+    auto table = buildShuffleTable();
+    out << indention << "alignas(16) static constexpr uint8_t ShuffleTable[" << TransTableRowSize
+        << "][" << (unsigned)ShuffleWidth << "] = {\n";
+    for (unsigned symbol = 0; symbol < TransTableRowSize; symbol++) {
+        out << indention << "    {";
+        for (StateID id = 0; id < ShuffleWidth; id++)
+            out << (unsigned)table[symbol][id] << "u" << (id + 1 == ShuffleWidth ? "" : ", ");
+        out << "}" << (symbol + 1 == TransTableRowSize ? "\n" : ",\n");
+    }
+    out << indention << "};\n";
+}
+
+SmallVector<NFA::SwitchState, 0>
+NFA::buildSwitchStates(SmallVectorImpl<SymbolBitmap> &bitmaps) const
+{
+    TransitiveTable table = buildTransitiveTable();
+    std::map<SymbolBitmap, unsigned> bitmapIndices;
+    SmallVector<SwitchState, 0> states;
+    for (const auto &row : table) {
+        std::map<StateID, SwitchCheck> groups;
+        for (Symbol lo = 0; lo <= MaxSymbolValue;) {
+            Symbol hi = lo;
+            while (hi < MaxSymbolValue && row[hi + 1] == row[lo])
+                ++hi;
+            SwitchCheck &check = groups[row[lo]];
+            check.Target = row[lo];
+            check.Ranges.push_back({lo, hi});
+            check.NumSymbols += hi - lo + 1;
+            lo = hi + 1;
+        }
+
+        SmallVector<SwitchCheck, 2> checks;
+        for (auto &group : groups)
+            checks.push_back(std::move(group.second));
+        auto biggest = std::max_element(checks.begin(), checks.end(),
+                                        [](const SwitchCheck &l, const SwitchCheck &r) {
+                                            return l.NumSymbols < r.NumSymbols;
+                                        });
+        SwitchState state;
+        state.DefaultTarget = biggest->Target;
+        checks.erase(biggest);
+
+        // states renumbered by a profile are in descending order of visits, and the invalid state
+        // is the last one
+        bool isProfiled = !CanonicalIDs.empty();
+        std::stable_sort(checks.begin(), checks.end(),
+                         [isProfiled](const SwitchCheck &l, const SwitchCheck &r) {
+                             return isProfiled ? l.Target < r.Target : l.NumSymbols > r.NumSymbols;
+                         });
+
+        for (SwitchCheck &check : checks) {
+            if (check.Ranges.size() <= MaxRangeChecks)
+                continue;
+            SymbolBitmap bitmap = {};
+            for (const auto &range : check.Ranges)
+                for (Symbol c = range.first; c <= range.second; c++)
+                    bitmap[c >> 6] |= (uint64_t)1 << (c & 63);
+            auto inserted = bitmapIndices.insert({bitmap, bitmaps.size()});
+            if (inserted.second)
+                bitmaps.push_back(bitmap);
+            check.BitmapIndex = inserted.first->second;
+        }
+        state.Checks = std::move(checks);
+        states.push_back(std::move(state));
+    }
+    return states;
+}
+
+void NFA::printSwitchBitmaps(ArrayRef<SymbolBitmap> bitmaps, raw_ostream &out, int indent) const
+{
+    SmallString<16> indention;
+    for (int i = 0; i < indent; i++)
+        indention += ' ';
+
+    out << indention << "static constexpr uint64_t SwitchBitmaps[" << bitmaps.size() << "]["
+        << std::tuple_size<SymbolBitmap>::value << "] = {\n";
+    for (size_t i = 0; i < bitmaps.size(); i++) {
+        out << indention << "    {";
+        for (size_t j = 0; j < bitmaps[i].size(); j++) {
+            out << "0x";
+            out.write_hex(bitmaps[i][j]);
+            out << "ull" << (j + 1 == bitmaps[i].size() ? "" : ", ");
+        }
+        out << "}" << (i + 1 == bitmaps.size() ? "\n" : ",\n");
+    }
+    out << indention << "};\n";
+}
+
 void NFA::printKindTable(raw_ostream &out, int indent) const
 {
     SmallString<16> indention;
     for (int i = 0; i < indent; i++)
         indention += ' ';
 
-    out << indention << "static const unsigned short KindTable[";
+    out << indention << "static constexpr unsigned short KindTable[";
     out << Storage.size() << "] = {\n";
     out << indention << "    ";
     for (size_t i = 0; i < Storage.size(); i++) {
-        const auto *state = Storage[i].get();
+        const auto *state = Storage[i];
         out << state->getKind() << "u";
         out << (i + 1 == Storage.size() ? "\n" : ", ");
     }
     out << indention << "};\n";
 }
 
+void NFA::printCanonicalIDTable(raw_ostream &out, int indent) const
+{
+    SmallString<16> indention;
+    for (int i = 0; i < indent; i++)
+        indention += ' ';
+
+    out << indention << "static constexpr " << getTypeBySize(Storage.size());
+    out << " CanonicalIDTable[" << Storage.size() << "] = {\n";
+    out << indention << "    ";
+    for (size_t i = 0; i < CanonicalIDs.size(); i++)
+        out << CanonicalIDs[i] << "u" << (i + 1 == CanonicalIDs.size() ? "\n" : ", ");
+    out << indention << "};\n";
+}
+
+void NFA::printModeTables(raw_ostream &out, int indent) const
+{
+    SmallString<16> indention;
+    for (int i = 0; i < indent; i++)
+        indention += ' ';
+
+    if (!ModeStartIDs.empty()) {
+        out << indention << "static constexpr " << getTypeBySize(Storage.size());
+        out << " ModeStartStateIDTable[" << ModeStartIDs.size() << "] = {";
+        for (size_t i = 0; i < ModeStartIDs.size(); i++)
+            out << ModeStartIDs[i] << "u" << (i + 1 == ModeStartIDs.size() ? "" : ", ");
+        out << "};\n";
+    }
+    if (!NextModes.empty()) {
+        out << indention << "static constexpr " << getTypeBySize(getNumModes());
+        out << " NextModeTable[" << Storage.size() << "] = {\n";
+        out << indention << "    ";
+        for (size_t i = 0; i < NextModes.size(); i++)
+            out << NextModes[i] << "u" << (i + 1 == NextModes.size() ? "\n" : ", ");
+        out << indention << "};\n";
+    }
+}
+
+SmallVector<NFA::BinaryTable, 3> NFA::buildBinaryTables(GeneratingMode mode) const
+{
+    SmallVector<BinaryTable, 3> tables;
+    if (mode == GM_Table || mode == GM_Shuffle) {
+        TransitiveTable table = buildTransitiveTable();
+        unsigned width = getWidthBySize(getAcceptFlag(Storage.size()) | Storage.size());
+        BinaryTable binary{"TransitiveTable", getTransitionType(), "", ""};
+        binary.Dims = "[" + std::to_string(table.size()) + "][" + std::to_string(TransTableRowSize)
+                      + "]";
+        for (const auto &row : table)
+            for (StateID target : row)
+                appendLittleEndian(binary.Data, encodeTransition(target), width);
+        tables.push_back(std::move(binary));
+    }
+    if (mode == GM_Shuffle) {
+        BinaryTable binary{"ShuffleTable", "uint8_t", "", ""};
+        binary.Dims = "[" + std::to_string(TransTableRowSize) + "]["
+                      + std::to_string(ShuffleWidth) + "]";
+        for (const auto &row : buildShuffleTable())
+            binary.Data.append(row.begin(), row.end());
+        tables.push_back(std::move(binary));
+    }
+    BinaryTable kinds{"KindTable", "unsigned short", "", ""};
+    kinds.Dims = "[" + std::to_string(Storage.size()) + "]";
+    for (const auto *state : Storage)
+        appendLittleEndian(kinds.Data, state->getKind(), sizeof(unsigned short));
+    tables.push_back(std::move(kinds));
+    return tables;
+}
+
+std::string NFA::getBinaryTableSymbol(StringRef prefix, StringRef name)
+{
+    return ("dzieja_" + prefix + "LexDFA_" + name).str();
+}
+
+void NFA::printBinaryTableDecls(ArrayRef<BinaryTable> tables, raw_ostream &out, StringRef prefix,
+                                StringRef end) const
+{
+    out << "// The biggest tables are defined in the assembly file generated with this file, which "
+           "includes\n// their little-endian data from the binary file.\n";
+    out << "#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__\n";
+    out << "#error \"the binary tables of the DFA are little-endian\"\n";
+    out << "#endif\n";
+    for (const auto &table : tables)
+        out << "extern \"C\" const " << table.Type << " "
+            << getBinaryTableSymbol(prefix, table.Name) << table.Dims << ";\n";
+    out << end;
+}
+
+bool NFA::writeBinaryTables(ArrayRef<BinaryTable> tables, StringRef basename,
+                            StringRef prefix) const
+{
+    SmallString<128> binFilename(basename);
+    binFilename += ".bin";
+    SmallString<128> asmFilename(basename);
+    asmFilename += ".S";
+
+    error_code EC;
+    raw_fd_ostream bin(binFilename, EC);
+    if (EC) {
+        error() << binFilename << ": " << EC.message() << "\n";
+        return false;
+    }
+    for (const auto &table : tables)
+        bin << table.Data;
+
+    // the assembler resolves relative paths of .incbin against its working directory
+    SmallString<128> binPath(binFilename);
+    if ((EC = sys::fs::make_absolute(binPath))) {
+        error() << binFilename << ": " << EC.message() << "\n";
+        return false;
+    }
+    raw_fd_ostream out(asmFilename, EC);
+    if (EC) {
+        error() << asmFilename << ": " << EC.message() << "\n";
+        return false;
+    }
+
+    printHeadComment(out, "\n");
+    out << "#ifdef __APPLE__\n"
+           "#define SYMBOL(name) _##name\n"
+           "    .const\n"
+           "#else\n"
+           "#define SYMBOL(name) name\n"
+           "    .section .rodata\n"
+           "#endif\n";
+    size_t offset = 0;
+    for (const auto &table : tables) {
+        std::string symbol = getBinaryTableSymbol(prefix, table.Name);
+        out << "\n";
+        out << "    .globl SYMBOL(" << symbol << ")\n";
+        out << "    .p2align 6\n";
+        out << "SYMBOL(" << symbol << "):\n";
+        out << "    .incbin \"";
+        out.write_escaped(binPath);
+        out << "\", " << offset << ", " << table.Data.size() << "\n";
+        offset += table.Data.size();
+    }
+    out << "\n";
+    out << "#ifndef __APPLE__\n"
+           "    .section .note.GNU-stack,\"\",%progbits\n"
+           "#endif\n";
+    return true;
+}
+
 void NFA::printHeadComment(raw_ostream &out, StringRef end) const
 {
     out << "//\n"
@@ -955,65 +1874,254 @@ void NFA::printHeadComment(raw_ostream &out, StringRef end) const
     out << end;
 }
 
-void NFA::printConstants(raw_ostream &out, StringRef end) const
+void NFA::printConstants(raw_ostream &out, StringRef prefix, StringRef end) const
 {
     out << "enum {\n";
-    out << "    DFA_StartStateID = " << Q0->getID() << "u,\n";
-    out << "    DFA_InvalidStateID = " << Storage.size() << "u\n";
+    out << "    " << prefix << "DFA_StartStateID = " << Q0->getID() << "u,\n";
+    out << "    " << prefix << "DFA_InvalidStateID = " << Storage.size() << "u,\n";
+    out << "    " << prefix << "DFA_AcceptFlag = " << getAcceptFlag(Storage.size()) << "u,\n";
+    out << "    " << prefix << "DFA_NumModes = " << getNumModes() << "u,\n";
+    out << "    " << prefix << "DFA_Hash = " << getCanonicalHash() << "u\n";
     out << "};";
     out << end;
 }
 
+void NFA::printDFAStruct(raw_ostream &out, GeneratingMode mode, StringRef prefix,
+                         ArrayRef<BinaryTable> externTables, StringRef end) const
+{
+    out << "// The DFA as constexpr data and functions for compile-time specialized lexers. It is "
+           "a\n// template only to define the static tables in a header without C++17 inline "
+           "variables.\n";
+    out << "template<typename Dummy = void>\n";
+    out << "struct " << prefix << "LexDFAImpl {\n";
+    out << "    enum : unsigned {\n";
+    out << "        StartStateID = " << prefix << "DFA_StartStateID,\n";
+    out << "        InvalidStateID = " << prefix << "DFA_InvalidStateID,\n";
+    out << "        AcceptFlag = " << prefix << "DFA_AcceptFlag,\n";
+    out << "        NumModes = " << prefix << "DFA_NumModes,\n";
+    if (mode == GM_Shuffle) {
+        out << "        HasShuffleTable = 1,\n";
+        out << "        ShuffleAcceptFlag = " << (unsigned)ShuffleAcceptFlag << "u\n";
+    }
+    else {
+        out << "        HasShuffleTable = 0\n";
+    }
+    out << "    };\n\n";
+    if (!externTables.empty()) {
+        for (const auto &table : externTables)
+            out << "    static constexpr const " << table.Type << " (&" << table.Name << ")"
+                << table.Dims << " = " << getBinaryTableSymbol(prefix, table.Name) << ";\n";
+        out << "\n";
+    }
+    if (externTables.empty() && (mode == GM_Table || mode == GM_Shuffle)) {
+        printTransitiveTable(buildTransitiveTable(), out, 4);
+        out << "\n";
+    }
+    if (externTables.empty() && mode == GM_Shuffle) {
+        printShuffleTable(out, 4);
+        out << "\n";
+    }
+    SmallVector<SymbolBitmap, 0> switchBitmaps;
+    SmallVector<SwitchState, 0> switchStates;
+    if (mode == GM_Switch)
+        switchStates = buildSwitchStates(switchBitmaps);
+    if (!switchBitmaps.empty()) {
+        printSwitchBitmaps(switchBitmaps, out, 4);
+        out << "\n";
+    }
+    if (externTables.empty()) {
+        printKindTable(out, 4);
+        out << "\n";
+    }
+    if (!CanonicalIDs.empty()) {
+        printCanonicalIDTable(out, 4);
+        out << "\n";
+    }
+    if (!ModeStartIDs.empty() || !NextModes.empty()) {
+        printModeTables(out, 4);
+        out << "\n";
+    }
+    if (mode == GM_Table || mode == GM_Shuffle)
+        printTransTableFunction(out, "\n\n");
+    else if (mode == GM_Switch)
+        printTransSwitchFunction(switchStates, out, "\n\n");
+    else
+        llvm_unreachable("Unknown mode of transitive function generating.");
+    printTerminalFunction(out, "\n\n");
+    printCanonicalIDFunction(out, "\n\n");
+    printModeFunctions(out, "\n");
+    out << "};\n\n";
+
+    // definitions of the static tables that are odr-used by the functions
+    for (const auto &table : externTables)
+        out << "template<typename Dummy>\n"
+            << "constexpr const " << table.Type << " (&" << prefix << "LexDFAImpl<Dummy>::"
+            << table.Name << ")" << table.Dims << ";\n";
+    if (externTables.empty() && (mode == GM_Table || mode == GM_Shuffle))
+        out << "template<typename Dummy>\n"
+            << "constexpr " << getTransitionType() << " " << prefix
+            << "LexDFAImpl<Dummy>::TransitiveTable[" << Storage.size() << "]["
+            << TransTableRowSize << "];\n";
+    if (externTables.empty() && mode == GM_Shuffle)
+        out << "template<typename Dummy>\n"
+            << "alignas(16) constexpr uint8_t " << prefix << "LexDFAImpl<Dummy>::ShuffleTable["
+            << TransTableRowSize << "][" << (unsigned)ShuffleWidth << "];\n";
+    if (!switchBitmaps.empty())
+        out << "template<typename Dummy>\n"
+            << "constexpr uint64_t " << prefix << "LexDFAImpl<Dummy>::SwitchBitmaps["
+            << switchBitmaps.size() << "][" << std::tuple_size<SymbolBitmap>::value << "];\n";
+    if (externTables.empty())
+        out << "template<typename Dummy>\n"
+            << "constexpr unsigned short " << prefix << "LexDFAImpl<Dummy>::KindTable["
+            << Storage.size() << "];\n";
+    if (!CanonicalIDs.empty())
+        out << "template<typename Dummy>\n"
+            << "constexpr " << getTypeBySize(Storage.size()) << " " << prefix
+            << "LexDFAImpl<Dummy>::CanonicalIDTable[" << Storage.size() << "];\n";
+    if (!ModeStartIDs.empty())
+        out << "template<typename Dummy>\n"
+            << "constexpr " << getTypeBySize(Storage.size()) << " " << prefix
+            << "LexDFAImpl<Dummy>::ModeStartStateIDTable[" << ModeStartIDs.size() << "];\n";
+    if (!NextModes.empty())
+        out << "template<typename Dummy>\n"
+            << "constexpr " << getTypeBySize(getNumModes()) << " " << prefix
+            << "LexDFAImpl<Dummy>::NextModeTable[" << Storage.size() << "];\n";
+    out << "\n";
+    out << "using " << prefix << "LexDFA = " << prefix << "LexDFAImpl<>;";
+    out << end;
+}
+
 void NFA::printTransTableFunction(raw_ostream &out, StringRef end) const
 {
-    out << "static inline unsigned DFA_delta(unsigned stateID, char symbol)\n";
-    out << "{\n";
-    auto transTable = buildTransitiveTable();
-    printTransitiveTable(transTable, out, 4);
-    out << "    return TransitiveTable[stateID][(unsigned char)symbol];\n";
-    out << "}" << end;
+    out << "    static constexpr unsigned delta(unsigned stateID, char symbol)\n";
+    out << "    {\n";
+    out << "        return TransitiveTable[stateID & (AcceptFlag - 1u)][(unsigned char)symbol];\n";
+    out << "    }" << end;
 }
 
-void NFA::printTransSwitchFunction(raw_ostream &out, StringRef end) const
+void NFA::printTransSwitchFunction(ArrayRef<SwitchState> states, raw_ostream &out,
+                                   StringRef end) const
 {
-    out << "static inline unsigned DFA_delta(unsigned stateID, char symbol)\n";
-    out << "{\n";
-    out << "    unsigned char usymbol = symbol;\n\n";
-    out << "#ifdef _MSC_VER\n";
-    out << "#pragma warning(push)\n";
-    // disable VS warning about a switch with the only default branch
-    out << "#pragma warning(disable : 4065)\n";
-    out << "#endif\n";
-    out << "    switch (stateID) {\n";
-    auto transTable = buildTransitiveTable();
-    const size_t InvalidID = Storage.size();
-    for (size_t id = 0; id < transTable.size(); ++id) {
-        out << "    case " << id << "u:\n";
-        out << "        switch (usymbol) {\n";
-        const auto &row = transTable[id];
-        for (unsigned ch = 0; ch < row.size(); ++ch)
-            if (row[ch] != InvalidID)
-                out << "        case " << ch << "u: return " << row[ch] << "u;\n";
-        out << "        default: return " << InvalidID << "u;\n";
-        out << "        }\n";
-    }
-    out << "    default:\n";
-    out << "        assert(0 && \"Unknown state ID is detected!\");\n";
-    out << "    }\n";
-    out << "#ifdef _MSC_VER\n";
-    out << "#pragma warning(pop)\n";
-    out << "#endif\n\n";
-    out << "    return DFA_InvalidStateID;\n";
-    out << "}" << end;
+    out << "    static constexpr unsigned delta(unsigned stateID, char symbol)\n";
+    out << "    {\n";
+    out << "        unsigned char usymbol = symbol;\n\n";
+    out << "        switch (stateID & (AcceptFlag - 1u)) {\n";
+    for (size_t id = 0; id < states.size(); ++id) {
+        out << "        case " << id << "u:\n";
+        auto isSingleSymbol = [](const SwitchCheck &check) { return check.NumSymbols == 1; };
+        bool hasInnerSwitch = count_if(states[id].Checks, isSingleSymbol) > MaxSymbolChecks;
+        for (const SwitchCheck &check : states[id].Checks) {
+            if (hasInnerSwitch && isSingleSymbol(check))
+                continue;
+            out << "            if (";
+            if (check.BitmapIndex >= 0) {
+                out << "(SwitchBitmaps[" << check.BitmapIndex
+                    << "][usymbol >> 6] >> (usymbol & 63u)) & 1u";
+            }
+            else {
+                ListSeparator separator(" || ");
+                for (const auto &range : check.Ranges) {
+                    out << separator;
+                    if (range.first == range.second)
+                        out << "usymbol == " << range.first << "u";
+                    else if (range.first == 0)
+                        out << "usymbol <= " << range.second << "u";
+                    else if (range.second == MaxSymbolValue)
+                        out << "usymbol >= " << range.first << "u";
+                    else
+                        // one unsigned comparison checks both bounds
+                        out << "usymbol - " << range.first << "u <= "
+                            << range.second - range.first << "u";
+                }
+            }
+            out << ")\n";
+            out << "                return " << encodeTransition(check.Target) << "u;\n";
+        }
+        if (hasInnerSwitch) {
+            out << "            switch (usymbol) {\n";
+            for (const SwitchCheck &check : states[id].Checks)
+                if (isSingleSymbol(check))
+                    out << "            case " << check.Ranges[0].first
+                        << "u: return " << encodeTransition(check.Target) << "u;\n";
+            out << "            }\n";
+        }
+        out << "            return " << encodeTransition(states[id].DefaultTarget) << "u;\n";
+    }
+    out << "        default:\n";
+    out << "            assert(0 && \"Unknown state ID is detected!\");\n";
+    out << "        }\n\n";
+    out << "        return InvalidStateID;\n";
+    out << "    }" << end;
 }
 
 void NFA::printTerminalFunction(raw_ostream &out, StringRef end) const
 {
-    out << "static inline unsigned short DFA_getKind(unsigned stateID)\n";
+    out << "    static constexpr unsigned short getKind(unsigned stateID)\n";
+    out << "    {\n";
+    out << "        return KindTable[stateID & (AcceptFlag - 1u)];\n";
+    out << "    }" << end;
+}
+
+void NFA::printCanonicalIDFunction(raw_ostream &out, StringRef end) const
+{
+    // states returned by delta may carry the accept flag, which is stripped here, so the table
+    // isn't indexed past its end
+    out << "    static constexpr unsigned getCanonicalStateID(unsigned stateID)\n";
+    out << "    {\n";
+    if (CanonicalIDs.empty())
+        out << "        return stateID & (AcceptFlag - 1u);\n";
+    else
+        out << "        return CanonicalIDTable[stateID & (AcceptFlag - 1u)];\n";
+    out << "    }" << end;
+}
+
+void NFA::printModeFunctions(raw_ostream &out, StringRef end) const
+{
+    out << "    static constexpr unsigned getStartStateID(unsigned "
+        << (ModeStartIDs.empty() ? "/*mode*/" : "mode") << ")\n";
+    out << "    {\n";
+    if (ModeStartIDs.empty())
+        out << "        return StartStateID;\n";
+    else
+        out << "        return ModeStartStateIDTable[mode];\n";
+    out << "    }\n\n";
+    // every state belongs to one mode, so the table keeps the mode itself for other tokens
+    if (NextModes.empty())
+        out << "    static constexpr unsigned getNextMode(unsigned /*stateID*/, unsigned mode)\n";
+    else
+        out << "    static constexpr unsigned getNextMode(unsigned stateID, unsigned /*mode*/)\n";
+    out << "    {\n";
+    if (NextModes.empty())
+        out << "        return mode;\n";
+    else
+        out << "        return NextModeTable[stateID & (AcceptFlag - 1u)];\n";
+    out << "    }" << end;
+}
+
+void NFA::printWrapperFunctions(raw_ostream &out, StringRef prefix, StringRef end) const
+{
+    out << "static inline unsigned " << prefix << "DFA_delta(unsigned stateID, char symbol)\n";
+    out << "{\n";
+    out << "    return " << prefix << "LexDFA::delta(stateID, symbol);\n";
+    out << "}\n\n";
+    out << "static inline unsigned short " << prefix << "DFA_getKind(unsigned stateID)\n";
+    out << "{\n";
+    out << "    return " << prefix << "LexDFA::getKind(stateID);\n";
+    out << "}\n\n";
+    out << "static inline unsigned " << prefix << "DFA_getCanonicalStateID(unsigned stateID)\n";
     out << "{\n";
-    printKindTable(out, 4);
-    out << "    return KindTable[stateID];\n";
-    out << "}" << end;
+    out << "    return " << prefix << "LexDFA::getCanonicalStateID(stateID);\n";
+    out << "}\n\n";
+    out << "static inline unsigned " << prefix << "DFA_getStartStateID(unsigned mode)\n";
+    out << "{\n";
+    out << "    return " << prefix << "LexDFA::getStartStateID(mode);\n";
+    out << "}\n\n";
+    out << "static inline unsigned " << prefix
+        << "DFA_getNextMode(unsigned stateID, unsigned mode)\n";
+    out << "{\n";
+    out << "    return " << prefix << "LexDFA::getNextMode(stateID, mode);\n";
+    out << "}";
+    out << end;
 }
 
 } // namespace dzieja
@@ -14,20 +14,28 @@
 #ifndef DZIEJA_UTILS_LEXGEN_FINITEAUTOMATON_H
 #define DZIEJA_UTILS_LEXGEN_FINITEAUTOMATON_H
 
+#include "CodePointSet.h"
 #include "dzieja/Basic/TokenKinds.h"
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/BitVector.h>
 #include <llvm/ADT/SmallSet.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/ConvertUTF.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <array>
 #include <cassert>
 #include <limits>
+#include <map>
 #include <memory>
 #include <queue>
 #include <set>
+#include <string>
+#include <tuple>
 #include <utility>
 
 
@@ -45,25 +53,57 @@ constexpr Symbol MaxSymbolValue = std::numeric_limits<unsigned char>::max();
 
 using StateSet = std::set<const State *>;
 
+/// Value of the -unify-token-kinds option.
+extern llvm::cl::opt<bool> UnifyTokenKinds;
 
+/// Returns the options of building automata that affect the result, e.g. for keys of cached
+/// automata.
+std::string getAutomatonOptions();
+
+/// Parses a symbol of a regex — a UTF-8 character or an escape sequence — and moves \p expr
+/// after it. A malformed symbol is reported, and the program exits.
+llvm::UTF32 parseSymbolCodePoint(const char *&expr);
+
+/// Parses a `[]`-expression of a regex and moves \p expr after it. Returns the code points the
+/// expression matches, surrogates excluded.
+CodePointSet parseSquareCodePoints(const char *&expr);
+
+/// Value of the maximal count of a `{m,}` quantifier.
+constexpr unsigned RepeatUnbounded = std::numeric_limits<unsigned>::max();
+
+/// The greatest count a `{m,n}` quantifier may have, so a typo doesn't build a huge automaton.
+constexpr unsigned MaxRepeatCount = 1000;
+
+/// Parses a `{m}`, `{m,}` or `{m,n}` quantifier of a regex and moves \p expr after it. \p max is
+/// \c RepeatUnbounded for `{m,}`. A malformed quantifier is reported, and the program exits.
+void parseRepeatBounds(const char *&expr, unsigned &min, unsigned &max);
+
+
+/// Edge labelled with the closed range of symbols [Lo, Hi]. An epsilon edge has \c Epsilon as the
+/// both bounds.
 class Edge {
     const State *Target;
-    Symbol Sym;
+    Symbol Lo;
+    Symbol Hi;
 
 public:
-    Edge(Symbol symbol, const State *target = nullptr) : Target(target), Sym(symbol)
+    Edge(Symbol lo, Symbol hi, const State *target = nullptr) : Target(target), Lo(lo), Hi(hi)
     {
-        assert((symbol == (MaxSymbolValue & symbol) || symbol == Epsilon)
-               && "the symbol must be either an ASCII character or the Epsilon");
+        assert(((lo <= hi && hi == (MaxSymbolValue & hi)) || (lo == Epsilon && hi == Epsilon))
+               && "the symbols must be either a range of bytes or the Epsilon");
     }
 
+    Edge(Symbol symbol, const State *target = nullptr) : Edge(symbol, symbol, target) {}
+
     /// This constructor needs in order to get correct converting from signed char to \p Symbol.
     Edge(char symbol, const State *target = nullptr) : Edge((Symbol)(unsigned char)symbol, target)
     {
     }
 
-    bool isEpsilon() const { return Sym == Epsilon; }
-    Symbol getSymbol() const { return Sym; }
+    bool isEpsilon() const { return Lo == Epsilon; }
+    Symbol getLo() const { return Lo; }
+    Symbol getHi() const { return Hi; }
+    bool contains(Symbol symbol) const { return Lo <= symbol && symbol <= Hi; }
     const State *getTarget() const { return Target; }
 };
 
@@ -74,26 +114,45 @@ public:
 ///
 /// \p kind is a marker of if the state is terminal. Non \c tok::unknown kind means that the state
 /// is terminal.
+///
+/// States and their edges live in the bump allocator of the owning \c NFA, so a state is trivially
+/// destructible. When edges array is full, it is reallocated in the allocator with doubled size.
 class State {
-    llvm::SmallVector<Edge, 0> Edges;
+    llvm::BumpPtrAllocator *Allocator;
+    Edge *Edges = nullptr;
+    unsigned NumEdges = 0;
+    unsigned EdgesCapacity = 0;
     StateID ID;
     tok::TokenKind Kind;
 
 public:
-    State(StateID id, tok::TokenKind kind = tok::unknown) : ID(id), Kind(kind) {}
+    State(StateID id, llvm::BumpPtrAllocator &allocator, tok::TokenKind kind = tok::unknown)
+        : Allocator(&allocator), ID(id), Kind(kind)
+    {
+    }
 
     StateID getID() const { return ID; }
     bool isTerminal() const { return Kind != tok::unknown; }
     tok::TokenKind getKind() const { return Kind; }
     void setKind(tok::TokenKind kind) { Kind = kind; }
-    const llvm::SmallVectorImpl<Edge> &getEdges() const { return Edges; }
-    void connectTo(const State *state, Symbol symbol) { Edges.push_back(Edge(symbol, state)); }
-    void connectTo(const State *state, char symbol) { Edges.push_back(Edge(symbol, state)); }
+    llvm::ArrayRef<Edge> getEdges() const { return {Edges, NumEdges}; }
+    void connectTo(const State *state, Symbol symbol) { addEdge(Edge(symbol, state)); }
+    void connectTo(const State *state, char symbol) { addEdge(Edge(symbol, state)); }
+    void connectTo(const State *state, Symbol lo, Symbol hi) { addEdge(Edge(lo, hi, state)); }
     StateSet getEspClosure() const;
 
 private:
     State(const State &) = delete;
     State &operator=(const State &) = delete;
+
+    void addEdge(const Edge &edge)
+    {
+        if (NumEdges == EdgesCapacity)
+            growEdges();
+        new (Edges + NumEdges++) Edge(edge);
+    }
+
+    void growEdges();
 };
 
 llvm::raw_ostream &operator<<(llvm::raw_ostream &out, const State &state);
@@ -118,28 +177,86 @@ llvm::raw_ostream &operator<<(llvm::raw_ostream &out, const State &state);
 /// After building of eNFA, you can create new \p NFA meeting DFA requirenments and then generate
 /// the DFA implementation via cpp-functions in a source file using \p generateCppImpl method.
 class NFA {
-    llvm::SmallVector<std::unique_ptr<State>, 0> Storage;
+    /// Shape of a sub-automaton that can be instantiated many times. Local state 0 is the start
+    /// state, and \p LastState is the last one, which is the start state too if the sub-automaton
+    /// has the only state. Edges are (from, to, lo, hi) tuples.
+    struct SubAutomatonPattern {
+        unsigned NumStates = 0;
+        unsigned LastState = 0;
+        llvm::SmallVector<std::tuple<unsigned, unsigned, Symbol, Symbol>, 0> Edges;
+    };
+
+    /// Owns memory of all the states and edges. It is kept by pointer to have the same address
+    /// after moving of the NFA.
+    std::unique_ptr<llvm::BumpPtrAllocator> Allocator;
+
+    /// States indexed by their IDs.
+    llvm::SmallVector<State *, 0> Storage;
     State *Q0;
     bool IsDFA = false;
 
+    /// IDs the states had before renumbering with \p buildRenumberedDFA, indexed by the current
+    /// IDs. It is empty if the states are not renumbered.
+    llvm::SmallVector<StateID, 0> CanonicalIDs;
+
+    /// Start states of the lexer modes of an automaton joined with \p joinModeAutomata, indexed by
+    /// modes. It is empty if the automaton has the only mode starting at \c Q0.
+    llvm::SmallVector<StateID, 0> ModeStartIDs;
+
+    /// Modes the lexer is in after a token accepted in a state, indexed by state IDs. It is empty
+    /// if no token changes the mode.
+    llvm::SmallVector<unsigned, 0> NextModes;
+
+    /// Already built `[]`-expressions. Big Unicode classes are expensive to build, and the same
+    /// class is often used several times, e.g. in the first and in the rest parts of identifier.
+    std::map<CodePointSet, SubAutomatonPattern> SquareCache;
+
+    /// Number of states built for `{m,n}` quantifiers.
+    size_t NumRepeatStates = 0;
+
 public:
     /// Specifies the mode of transitive function implementation.
     enum GeneratingMode {
-        GM_Table, /// Generate delta-func via transitive table
-        GM_Switch /// Generate delta-func via switch-case control flow
+        GM_Table,  /// Generate delta-func via transitive table
+        GM_Switch, /// Generate delta-func via switch-case control flow
+        GM_Shuffle /// Generate the transitive table and the table for SIMD byte shuffles
     };
 
+    /// Returns true if the DFA is small enough for \c GM_Shuffle mode: every state including the
+    /// invalid one is a lane of a 16-byte vector.
+    bool fitsShuffleTable() const;
+
     NFA() { clear(); }
     NFA(NFA &&) = default;
     NFA &operator=(NFA &&) = default;
 
-    /// Reset the NFA to the state with the single start state.
+    /// Reset the NFA to the state with the single start state. It frees memory of all the states at
+    /// once without destroying them one by one.
     void clear();
 
     /// Receives Q0 state — the start state of the finite automaton.
     const State *getStartState() const { return Q0; }
 
     size_t getNumStates() const { return Storage.size(); }
+    size_t getNumEdges() const;
+
+    /// Returns the number of states built for `{m,n}` quantifiers of the parsed regexes.
+    size_t getNumRepeatStates() const { return NumRepeatStates; }
+
+    /// Returns ID of the state in the DFA before any renumbering. Profiles of the lexer are
+    /// collected with these IDs, so they don't depend on the layout of the generated tables.
+    StateID getCanonicalID(StateID id) const
+    {
+        return CanonicalIDs.empty() ? id : CanonicalIDs[id];
+    }
+
+    size_t getNumModes() const { return ModeStartIDs.empty() ? 1 : ModeStartIDs.size(); }
+
+    StateID getModeStartID(unsigned mode) const
+    {
+        assert(mode < getNumModes() && "unknown mode");
+        return ModeStartIDs.empty() ? Q0->getID() : ModeStartIDs[mode];
+    }
 
     /// Builds an NFA-graph from a raw string without interpreting special characters.
     void parseRawString(const char *str, tok::TokenKind kind);
@@ -149,6 +266,18 @@ public:
     /// For detailed description look at `utils/LexGen/README.md`.
     void parseRegex(const char *regex, tok::TokenKind kind);
 
+    /// Joins a copy of the \p other automaton to the start state with an epsilon edge.
+    ///
+    /// If \p kind is not \c tok::unknown, all the terminal states of the copy get this kind.
+    void appendAutomaton(const NFA &other, tok::TokenKind kind = tok::unknown);
+
+    /// Writes the automaton in the text format that \p read understands.
+    void write(llvm::raw_ostream &out) const;
+
+    /// Reads an automaton written with \p write from the beginning of \p text and moves \p text
+    /// after it. Returns false if the text is malformed.
+    bool read(llvm::StringRef &text);
+
 private:
     /// Specifies start and last (quasi-terminal) state of the part of an NFA
     using SubAutomaton = std::pair<State *, State *>;
@@ -158,13 +287,22 @@ private:
     SubAutomaton parseSymbol(const char *&expr);
     SubAutomaton parseParen(const char *&expr);
     SubAutomaton parseSquare(const char *&expr);
-    SubAutomaton buildSquareSubAutom(const llvm::BitVector &unicodeMask);
+    SubAutomaton buildSquareSubAutom(const CodePointSet &codePoints);
     SubAutomaton parseQualifier(const char *&expr, SubAutomaton);
     SubAutomaton parseQuestion(const char *&expr, SubAutomaton);
     SubAutomaton parseStar(const char *&expr, SubAutomaton);
     SubAutomaton parsePlus(const char *&expr, SubAutomaton);
+    SubAutomaton parseRepeat(const char *&expr, SubAutomaton);
+
+    SubAutomaton makeStar(SubAutomaton autom);
 
-    SubAutomaton cloneSubAutomaton(SubAutomaton autom);
+    /// Builds the repetition of \p autom from \p min to \p max times, \p max may be
+    /// \c RepeatUnbounded. The copies are instantiated from one pattern.
+    SubAutomaton makeRepeat(SubAutomaton autom, unsigned min, unsigned max);
+
+    /// Remembers the shape of a sub-automaton. It must not be connected to other states yet.
+    SubAutomatonPattern makePattern(SubAutomaton autom) const;
+    SubAutomaton instantiatePattern(const SubAutomatonPattern &pattern);
 
 public:
     /// Builds new NFA instance that meets the DFA requirements.
@@ -175,13 +313,59 @@ public:
     /// Builds new NFA instance that meets the minimized DFA requirements.
     NFA buildMinimizedDFA() const;
 
+    /// Builds an equivalent NFA without epsilon edges and with less states, so \p buildDFA has
+    /// less work to do.
+    ///
+    /// Every state gets the edges of its epsilon closure, states that are unreachable or can't
+    /// reach a terminal state are removed, and then bisimilar states — ones of the same kind
+    /// whose edges lead to the same merged states by the same symbols — are merged. The reduced
+    /// states keep the order of their earliest original states, so priorities of token kinds are
+    /// kept.
+    NFA buildReducedNFA() const;
+
+    /// Joins automata of lexer modes into one automaton, so the modes share the tables and differ
+    /// in their start states only. States of every mode keep their order and are contiguous. The
+    /// result is a DFA if all the automata are DFAs.
+    ///
+    /// \p nextModes is indexed by token kinds. For a kind switching the lexer mode it is the index
+    /// of the next mode, for other kinds it is any value not less than the number of the modes.
+    static NFA joinModeAutomata(llvm::ArrayRef<NFA> modeAutomata,
+                                llvm::ArrayRef<unsigned> nextModes);
+
+    /// Builds a copy of the DFA where states are numbered in descending order of their \p weights,
+    /// which are indexed by canonical IDs. States with equal weights keep their relative order. It
+    /// is used to put the hottest rows of the transitive table together.
+    NFA buildRenumberedDFA(llvm::ArrayRef<uint64_t> weights) const;
+
+    /// Returns a hash of the DFA with the states numbered by their canonical IDs, so it is the same
+    /// for a DFA and its renumbered copies. Profiles of the lexer carry the hash, and a profile of
+    /// another grammar is recognized by it.
+    uint32_t getCanonicalHash() const;
+
+    /// Returns true if the DFA and the \p other DFA have the same modes, and in every mode they
+    /// accept the same strings as tokens of the same kinds. States may be numbered differently,
+    /// and the DFAs needn't be minimized.
+    bool isEquivalentDFA(const NFA &other) const;
+
     /// Generates '\p filename' source file which contains transitive funciton and terminal
     /// function in order to pass through the \c NFA.
-    bool generateCppImpl(llvm::StringRef filename, GeneratingMode mode) const;
+    ///
+    /// All the generated names start with \p prefix, so DFAs of different grammars can be included
+    /// into one translation unit.
+    ///
+    /// If \p tablesBasename isn't empty, the transitive, shuffle and kind tables are written as raw
+    /// little-endian data to '\p tablesBasename.bin' instead of C++ initializers, and
+    /// '\p tablesBasename.S' defines their symbols with \c .incbin directives. The source file
+    /// only declares the tables then, so it is small and is compiled quickly, and the assembly file
+    /// must be linked into the program.
+    bool generateCppImpl(llvm::StringRef filename, GeneratingMode mode,
+                         llvm::StringRef prefix = "", llvm::StringRef tablesBasename = "") const;
 
     llvm::raw_ostream &print(llvm::raw_ostream &) const;
 
 private:
+    friend class DerivativeDFABuilder;
+
     NFA(const NFA &) = delete;
     NFA &operator=(const NFA &) = delete;
 
@@ -202,34 +386,141 @@ private:
     /// It uses an algorithm with complexity O(n^4), and is memory efficient.
     llvm::SmallVector<llvm::BitVector, 0> buildDistinguishTableO4() const;
 
+    /// Parallel version of \p buildDistinguishTableO2. The queue is processed by generations:
+    /// pairs of a generation are sharded between threads, and newly found pairs are merged into
+    /// the table at the end of the generation.
+    llvm::SmallVector<llvm::BitVector, 0> buildDistinguishTableO2Parallel() const;
+
+    /// Parallel version of \p buildDistinguishTableO4. Every pass reads the table of the previous
+    /// pass and writes a new one, and rows are sharded between threads, so no synchronization is
+    /// needed inside a pass.
+    llvm::SmallVector<llvm::BitVector, 0> buildDistinguishTableO4Parallel() const;
+
     /// Prints the distinguishable table. It's used as debug information only.
     void dumpDistinguishTable(const llvm::SmallVector<llvm::BitVector, 0> &distingTable,
                               llvm::raw_ostream &out) const;
 
     enum { TransTableRowSize = 256 };
+
+    /// Number of lanes of the shuffled vector and the flag of accepting states in them. The flag
+    /// is ignored by the shuffle instruction, which takes the low 4 bits of indices only.
+    enum : uint8_t { ShuffleWidth = 16, ShuffleAcceptFlag = 0x10 };
     using TransitiveTable = llvm::SmallVector<llvm::SmallVector<StateID, TransTableRowSize>, 0>;
     using ReverseTable =
         llvm::SmallVector<llvm::SmallVector<llvm::SmallVector<StateID, 0>, TransTableRowSize>, 0>;
 
     TransitiveTable buildTransitiveTable() const;
+
+    /// Returns value of a transition to state \p id in the generated code. If the state is
+    /// terminal, its ID is marked with the accept flag, so the lexer doesn't need to look up kinds
+    /// of states on its hot path.
+    StateID encodeTransition(StateID id) const;
     ReverseTable buildReverseTransitiveTable() const;
     void printTransitiveTable(const TransitiveTable &, llvm::raw_ostream &, int indent = 0) const;
     void printKindTable(llvm::raw_ostream &, int indent = 0) const;
 
+    /// Returns the table of \c GM_Shuffle mode. Row of a symbol keeps targets of all the states.
+    llvm::SmallVector<std::array<uint8_t, ShuffleWidth>, 0> buildShuffleTable() const;
+    void printShuffleTable(llvm::raw_ostream &, int indent = 0) const;
+
+    /// Set of symbols tested by one bitmap check of \c GM_Switch mode, 64 symbols per word.
+    using SymbolBitmap = std::array<uint64_t, 4>;
+
+    /// Test of the symbols leading from a state to \p Target in \c GM_Switch mode. A few ranges are
+    /// tested with comparisons, and scattered symbols are tested with the bitmap \p BitmapIndex.
+    struct SwitchCheck {
+        StateID Target;
+        llvm::SmallVector<std::pair<Symbol, Symbol>, 2> Ranges;
+        unsigned NumSymbols = 0;
+        int BitmapIndex = -1;
+    };
+
+    /// Checks of a state in the order they are printed, and the target of the symbols that pass no
+    /// check.
+    struct SwitchState {
+        llvm::SmallVector<SwitchCheck, 2> Checks;
+        StateID DefaultTarget;
+    };
+
+    /// Targets with more ranges than \c MaxRangeChecks are tested with bitmaps. If a state has more
+    /// than \c MaxSymbolChecks targets of single symbols, they are tested with an inner switch.
+    enum { MaxRangeChecks = 2, MaxSymbolChecks = 4 };
+
+    /// Groups transitions of every state by targets for \c GM_Switch mode. The target of the most
+    /// symbols needs no check, and the others are ordered by expected frequency: by the number of
+    /// symbols, or by the order of states if they are renumbered by a profile. Distinct bitmaps of
+    /// all the states are added to \p bitmaps.
+    llvm::SmallVector<SwitchState, 0>
+    buildSwitchStates(llvm::SmallVectorImpl<SymbolBitmap> &bitmaps) const;
+    void printSwitchBitmaps(llvm::ArrayRef<SymbolBitmap> bitmaps, llvm::raw_ostream &,
+                            int indent = 0) const;
+    void printCanonicalIDTable(llvm::raw_ostream &, int indent = 0) const;
+    void printModeTables(llvm::raw_ostream &, int indent = 0) const;
+
+    /// Returns type of cells of the transitive table, which keep a state ID with the accept flag.
+    const char *getTransitionType() const;
+
+    /// Table written by \p writeBinaryTables: the C++ type and the dimensions of the array, and
+    /// its little-endian data.
+    struct BinaryTable {
+        const char *Name;
+        const char *Type;
+        std::string Dims;
+        std::string Data;
+    };
+
     void printHeadComment(llvm::raw_ostream &, llvm::StringRef end = "") const;
-    void printConstants(llvm::raw_ostream &, llvm::StringRef end = "") const;
+    void printConstants(llvm::raw_ostream &, llvm::StringRef prefix,
+                        llvm::StringRef end = "") const;
+
+    /// Prints \c LexDFA structure with the tables and the functions of the DFA as \c constexpr
+    /// members. It is used by \c BasicLexer, and the \c DFA_* functions are wrappers of it.
+    ///
+    /// If \p externTables isn't empty, these tables are references to the arrays defined by the
+    /// assembly file of \p writeBinaryTables instead of \c constexpr data.
+    void printDFAStruct(llvm::raw_ostream &, GeneratingMode mode, llvm::StringRef prefix,
+                        llvm::ArrayRef<BinaryTable> externTables, llvm::StringRef end = "") const;
+
+    /// Returns the tables of \p mode which are written as binary data.
+    llvm::SmallVector<BinaryTable, 3> buildBinaryTables(GeneratingMode mode) const;
+
+    /// Returns the name of the symbol of table \p name defined by the assembly file.
+    static std::string getBinaryTableSymbol(llvm::StringRef prefix, llvm::StringRef name);
+
+    /// Prints declarations of the arrays defined by the assembly file of \p writeBinaryTables.
+    void printBinaryTableDecls(llvm::ArrayRef<BinaryTable> tables, llvm::raw_ostream &,
+                               llvm::StringRef prefix, llvm::StringRef end = "") const;
+
+    /// Writes '\p basename.bin' with data of \p tables and '\p basename.S' defining their symbols.
+    bool writeBinaryTables(llvm::ArrayRef<BinaryTable> tables, llvm::StringRef basename,
+                           llvm::StringRef prefix) const;
 
     /// Prints transitive function implemented via transitive table.
     void printTransTableFunction(llvm::raw_ostream &, llvm::StringRef end = "") const;
 
-    /// Prints transitive function implemented via switch control flow.
-    void printTransSwitchFunction(llvm::raw_ostream &, llvm::StringRef end = "") const;
+    /// Prints transitive function implemented via switch control flow. Every case of a state is a
+    /// chain of range and bitmap checks built by \p buildSwitchStates, and many single symbols
+    /// are tested with an inner switch after them.
+    void printTransSwitchFunction(llvm::ArrayRef<SwitchState> states, llvm::raw_ostream &,
+                                  llvm::StringRef end = "") const;
 
     /// Prints function returning TokenKind of given state.
     ///
     /// If the kind is \c tok::unknown it means that the state is not terminal, otherwise it is
     /// terminal and marks the end of the parsed token.
     void printTerminalFunction(llvm::raw_ostream &, llvm::StringRef end = "") const;
+
+    /// Prints function returning canonical ID of given state. It is used by the profiling build of
+    /// the lexer. The state may be marked with the accept flag, which is ignored.
+    void printCanonicalIDFunction(llvm::raw_ostream &, llvm::StringRef end = "") const;
+
+    /// Prints functions returning the start state of a lexer mode and the mode after a token.
+    /// For a DFA without modes they are constants, so the lexer gets no overhead.
+    void printModeFunctions(llvm::raw_ostream &, llvm::StringRef end = "") const;
+
+    /// Prints the \c DFA_* functions that forward to \c LexDFA members.
+    void printWrapperFunctions(llvm::raw_ostream &, llvm::StringRef prefix,
+                               llvm::StringRef end = "") const;
 };
 
 } // namespace dzieja
@@ -0,0 +1,453 @@
+#include "RegexDerivatives.h"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/WithColor.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cassert>
+#include <cstdlib>
+
+using namespace llvm;
+
+namespace dzieja {
+
+static auto &error()
+{
+    return WithColor::error(llvm::errs(), "dzieja-lexgen");
+}
+
+ByteSet ByteSet::getRange(unsigned lo, unsigned hi)
+{
+    assert(lo <= hi && hi <= MaxSymbolValue && "invalid range of bytes");
+    ByteSet result;
+    for (unsigned symbol = lo; symbol <= hi; symbol++)
+        result.Words[symbol / 64] |= uint64_t(1) << (symbol % 64);
+    return result;
+}
+
+ByteSet &ByteSet::operator|=(const ByteSet &other)
+{
+    for (unsigned i = 0; i < Words.size(); i++)
+        Words[i] |= other.Words[i];
+    return *this;
+}
+
+const RegexTerm *DerivativeDFABuilder::getTerm(RegexTerm::TermKind kind, bool nullable,
+                                               const ByteSet &bytes,
+                                               ArrayRef<const RegexTerm *> operands)
+{
+    TermKey key(kind, bytes, std::vector<const RegexTerm *>(operands.begin(), operands.end()));
+    auto &term = Terms[std::move(key)];
+    if (!term)
+        term = std::make_unique<RegexTerm>(kind, nullable, Terms.size() - 1, bytes, operands);
+    return term.get();
+}
+
+const RegexTerm *DerivativeDFABuilder::getEmpty()
+{
+    return getTerm(RegexTerm::TK_Empty, false, {}, {});
+}
+
+const RegexTerm *DerivativeDFABuilder::getEpsilon()
+{
+    return getTerm(RegexTerm::TK_Epsilon, true, {}, {});
+}
+
+const RegexTerm *DerivativeDFABuilder::getBytes(const ByteSet &bytes)
+{
+    if (bytes.empty())
+        return getEmpty();
+    return getTerm(RegexTerm::TK_Bytes, false, bytes, {});
+}
+
+const RegexTerm *DerivativeDFABuilder::getConcat(const RegexTerm *first, const RegexTerm *second)
+{
+    if (first->getKind() == RegexTerm::TK_Empty || second->getKind() == RegexTerm::TK_Empty)
+        return getEmpty();
+    if (first->getKind() == RegexTerm::TK_Epsilon)
+        return second;
+    if (second->getKind() == RegexTerm::TK_Epsilon)
+        return first;
+    // (rs)t = r(st), so a concatenation is a list, and its first element is easy to derive
+    if (first->getKind() == RegexTerm::TK_Concat)
+        return getConcat(first->getOperands()[0], getConcat(first->getOperands()[1], second));
+    return getTerm(RegexTerm::TK_Concat, first->isNullable() && second->isNullable(), {},
+                   {first, second});
+}
+
+const RegexTerm *DerivativeDFABuilder::getAlt(ArrayRef<const RegexTerm *> operands)
+{
+    // Nested alternatives are flattened, all the byte sets are merged into one, and the operands
+    // are sorted without duplicates.
+    std::vector<const RegexTerm *> flat;
+    ByteSet bytes;
+    bool hasBytes = false;
+    bool hasNullable = false;
+    auto add = [&](const RegexTerm *term) {
+        switch (term->getKind()) {
+        case RegexTerm::TK_Empty:
+            break;
+        case RegexTerm::TK_Bytes:
+            bytes |= term->getBytes();
+            hasBytes = true;
+            break;
+        default:
+            hasNullable |= term->isNullable() && term->getKind() != RegexTerm::TK_Epsilon;
+            flat.push_back(term);
+            break;
+        }
+    };
+    for (const RegexTerm *operand : operands) {
+        if (operand->getKind() != RegexTerm::TK_Alt) {
+            add(operand);
+            continue;
+        }
+        for (const RegexTerm *nested : operand->getOperands())
+            add(nested);
+    }
+    if (hasBytes)
+        flat.push_back(getBytes(bytes));
+    // ε is redundant next to another nullable operand
+    if (hasNullable)
+        llvm::erase_if(flat, [](const RegexTerm *term) {
+            return term->getKind() == RegexTerm::TK_Epsilon;
+        });
+    llvm::sort(flat, [](const RegexTerm *left, const RegexTerm *right) {
+        return left->getID() < right->getID();
+    });
+    flat.erase(std::unique(flat.begin(), flat.end()), flat.end());
+
+    if (flat.empty())
+        return getEmpty();
+    if (flat.size() == 1)
+        return flat[0];
+    bool nullable = llvm::any_of(flat, [](const RegexTerm *term) { return term->isNullable(); });
+    return getTerm(RegexTerm::TK_Alt, nullable, {}, flat);
+}
+
+const RegexTerm *DerivativeDFABuilder::getStar(const RegexTerm *operand)
+{
+    switch (operand->getKind()) {
+    case RegexTerm::TK_Empty:
+    case RegexTerm::TK_Epsilon:
+        return getEpsilon();
+    case RegexTerm::TK_Star:
+        return operand;
+    default:
+        return getTerm(RegexTerm::TK_Star, true, {}, {operand});
+    }
+}
+
+const RegexTerm *DerivativeDFABuilder::getSequence(ArrayRef<const RegexTerm *> terms)
+{
+    const RegexTerm *result = getEpsilon();
+    for (const RegexTerm *term : llvm::reverse(terms))
+        result = getConcat(term, result);
+    return result;
+}
+
+const RegexTerm *DerivativeDFABuilder::getCodePoint(UTF32 codePoint)
+{
+    char u8seq[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+    char *ptr = u8seq;
+    if (!ConvertCodePointToUTF8(codePoint, ptr)) {
+        auto &err = error() << "can't convert code point ";
+        err.write_hex(codePoint) << " into UTF8 sequence\n";
+        std::exit(1);
+    }
+
+    SmallVector<const RegexTerm *, UNI_MAX_UTF8_BYTES_PER_CODE_POINT> bytes;
+    for (const char *iter = u8seq; iter != ptr; ++iter)
+        bytes.push_back(getBytes(ByteSet::getRange((unsigned char)*iter, (unsigned char)*iter)));
+    return getSequence(bytes);
+}
+
+void DerivativeDFABuilder::addRawString(const char *str, tok::TokenKind kind)
+{
+    SmallVector<const RegexTerm *, 16> bytes;
+    for (; *str; str++)
+        bytes.push_back(getBytes(ByteSet::getRange((unsigned char)*str, (unsigned char)*str)));
+    Tokens.emplace_back(getSequence(bytes), kind);
+}
+
+void DerivativeDFABuilder::addRegex(const char *expr, tok::TokenKind kind)
+{
+    const RegexTerm *term = parseSequence(expr);
+    if (*expr == ')') {
+        error() << "unexpected close paren ')' without previous open one\n";
+        std::exit(1);
+    }
+    assert(*expr == '\0' && "parsing must be finished with zero character");
+    Tokens.emplace_back(term, kind);
+}
+
+const RegexTerm *DerivativeDFABuilder::parseSequence(const char *&expr)
+{
+    SmallVector<const RegexTerm *, 4> alternatives;
+    SmallVector<const RegexTerm *, 8> items;
+    for (;;) {
+        const RegexTerm *term;
+        switch (*expr) {
+        case '\0':
+        case ')':
+            alternatives.push_back(getSequence(items));
+            return getAlt(alternatives);
+        case '|':
+            alternatives.push_back(getSequence(items));
+            items.clear();
+            ++expr;
+            continue;
+        case '(':
+            term = parseParen(expr);
+            break;
+        case '[':
+            term = parseSquare(expr);
+            break;
+        default:
+            term = getCodePoint(parseSymbolCodePoint(expr));
+            break;
+        }
+        items.push_back(parseQualifier(expr, term));
+    }
+}
+
+const RegexTerm *DerivativeDFABuilder::parseParen(const char *&expr)
+{
+    assert(*expr == '(' && "open paren '(' is exptected");
+    ++expr;
+    const RegexTerm *term = parseSequence(expr);
+    if (*expr != ')') {
+        error() << "close paren ')' is expected!\n";
+        std::exit(1);
+    }
+    ++expr;
+    return term;
+}
+
+const RegexTerm *DerivativeDFABuilder::parseSquare(const char *&expr)
+{
+    SmallVector<UTF8Sequence, 16> sequences;
+    parseSquareCodePoints(expr).getUTF8Sequences(sequences);
+
+    SmallVector<const RegexTerm *, 16> alternatives;
+    for (const UTF8Sequence &seq : sequences) {
+        SmallVector<const RegexTerm *, UNI_MAX_UTF8_BYTES_PER_CODE_POINT> bytes;
+        for (unsigned i = 0; i < seq.Length; i++)
+            bytes.push_back(getBytes(ByteSet::getRange(seq.Lo[i], seq.Hi[i])));
+        alternatives.push_back(getSequence(bytes));
+    }
+    return getAlt(alternatives);
+}
+
+const RegexTerm *DerivativeDFABuilder::parseQualifier(const char *&expr, const RegexTerm *term)
+{
+    switch (*expr) {
+    case '?':
+        term = getAlt({term, getEpsilon()});
+        ++expr;
+        break;
+    case '*':
+        term = getStar(term);
+        ++expr;
+        break;
+    case '+':
+        term = getConcat(term, getStar(term));
+        ++expr;
+        break;
+    case '{':
+        term = parseRepeat(expr, term);
+        break;
+    default:
+        return term;
+    }
+    if (*expr == '?' || *expr == '*' || *expr == '+' || *expr == '{') {
+        error() << "qualifier mustn't be after another qualifier\n";
+        std::exit(1);
+    }
+    return term;
+}
+
+const RegexTerm *DerivativeDFABuilder::parseRepeat(const char *&expr, const RegexTerm *term)
+{
+    unsigned min, max;
+    parseRepeatBounds(expr, min, max);
+
+    // r{m,n} = r...r(r(r...)?)? with m copies before the optional ones. Equal terms are shared, so
+    // the copies cost nothing.
+    SmallVector<const RegexTerm *, 8> items(min, term);
+    if (max == RepeatUnbounded) {
+        items.push_back(getStar(term));
+    }
+    else {
+        const RegexTerm *optional = getEpsilon();
+        for (unsigned i = min; i < max; i++)
+            optional = getAlt({getConcat(term, optional), getEpsilon()});
+        items.push_back(optional);
+    }
+    return getSequence(items);
+}
+
+const RegexTerm *DerivativeDFABuilder::derive(const RegexTerm *term, unsigned char symbol)
+{
+    auto iter = Derivatives.find({term, symbol});
+    if (iter != Derivatives.end())
+        return iter->second;
+
+    const RegexTerm *result = nullptr;
+    ArrayRef<const RegexTerm *> operands = term->getOperands();
+    switch (term->getKind()) {
+    case RegexTerm::TK_Empty:
+    case RegexTerm::TK_Epsilon:
+        result = getEmpty();
+        break;
+    case RegexTerm::TK_Bytes:
+        result = term->getBytes().contains(symbol) ? getEpsilon() : getEmpty();
+        break;
+    case RegexTerm::TK_Concat:
+        // d(rs) = d(r)s | d(s) if r matches the empty string
+        result = getConcat(derive(operands[0], symbol), operands[1]);
+        if (operands[0]->isNullable())
+            result = getAlt({result, derive(operands[1], symbol)});
+        break;
+    case RegexTerm::TK_Alt: {
+        SmallVector<const RegexTerm *, 8> derivatives;
+        for (const RegexTerm *operand : operands)
+            derivatives.push_back(derive(operand, symbol));
+        result = getAlt(derivatives);
+        break;
+    }
+    case RegexTerm::TK_Star:
+        result = getConcat(derive(operands[0], symbol), term);
+        break;
+    }
+    assert(result && "unknown kind of regex term");
+    Derivatives[{term, symbol}] = result;
+    return result;
+}
+
+const std::vector<ByteSet> &DerivativeDFABuilder::getClassSets(const RegexTerm *term)
+{
+    auto iter = ClassSets.find(term);
+    if (iter != ClassSets.end())
+        return iter->second;
+
+    std::vector<ByteSet> result;
+    auto append = [&](const RegexTerm *operand) {
+        const std::vector<ByteSet> &sets = getClassSets(operand);
+        result.insert(result.end(), sets.begin(), sets.end());
+    };
+    ArrayRef<const RegexTerm *> operands = term->getOperands();
+    switch (term->getKind()) {
+    case RegexTerm::TK_Empty:
+    case RegexTerm::TK_Epsilon:
+        break;
+    case RegexTerm::TK_Bytes:
+        result.push_back(term->getBytes());
+        break;
+    case RegexTerm::TK_Concat:
+        append(operands[0]);
+        if (operands[0]->isNullable())
+            append(operands[1]);
+        break;
+    case RegexTerm::TK_Alt:
+    case RegexTerm::TK_Star:
+        for (const RegexTerm *operand : operands)
+            append(operand);
+        break;
+    }
+    llvm::sort(result);
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return ClassSets[term] = std::move(result);
+}
+
+NFA DerivativeDFABuilder::build()
+{
+    // A state is the list of non-empty derivatives of the token regexes with the indices of the
+    // tokens, in order of the tokens.
+    using StateKey = std::vector<std::pair<unsigned, const RegexTerm *>>;
+    std::map<StateKey, State *> states;
+    SmallVector<const std::pair<const StateKey, State *> *, 0> worklist;
+
+    NFA dfa;
+    dfa.Storage.pop_back(); // by default NFA contains the start state, but here we don't need it
+    auto getState = [&](StateKey key) {
+        auto inserted = states.insert({std::move(key), nullptr});
+        if (inserted.second) {
+            tok::TokenKind kind = tok::unknown;
+            for (const auto &item : inserted.first->first) {
+                if (item.second->isNullable()) {
+                    kind = Tokens[item.first].second;
+                    break;
+                }
+            }
+            inserted.first->second = dfa.makeState(kind);
+            worklist.push_back(&*inserted.first);
+        }
+        return inserted.first->second;
+    };
+
+    StateKey startKey;
+    for (unsigned i = 0; i < Tokens.size(); i++)
+        if (Tokens[i].first->getKind() != RegexTerm::TK_Empty)
+            startKey.emplace_back(i, Tokens[i].first);
+    dfa.Q0 = getState(std::move(startKey));
+
+    for (size_t i = 0; i < worklist.size(); i++) {
+        const StateKey &key = worklist[i]->first;
+        State *state = worklist[i]->second;
+
+        // bytes are split into classes by membership in every class set of the derivatives
+        std::vector<ByteSet> sets;
+        for (const auto &item : key) {
+            const std::vector<ByteSet> &termSets = getClassSets(item.second);
+            sets.insert(sets.end(), termSets.begin(), termSets.end());
+        }
+        llvm::sort(sets);
+        sets.erase(std::unique(sets.begin(), sets.end()), sets.end());
+        std::array<unsigned, MaxSymbolValue + 1> classes = {};
+        unsigned numClasses = 1;
+        for (const ByteSet &set : sets) {
+            SmallVector<unsigned, 16> newClasses(numClasses * 2, ~0u);
+            unsigned next = 0;
+            for (unsigned symbol = 0; symbol <= MaxSymbolValue; symbol++) {
+                unsigned &newClass = newClasses[classes[symbol] * 2 + set.contains(symbol)];
+                if (newClass == ~0u)
+                    newClass = next++;
+                classes[symbol] = newClass;
+            }
+            numClasses = next;
+        }
+
+        // every class is derived by its first byte
+        SmallVector<State *, 16> targets(numClasses, nullptr);
+        SmallVector<bool, 16> isDerived(numClasses, false);
+        for (unsigned symbol = 0; symbol <= MaxSymbolValue; symbol++) {
+            unsigned classID = classes[symbol];
+            if (isDerived[classID])
+                continue;
+            isDerived[classID] = true;
+            StateKey nextKey;
+            for (const auto &item : key) {
+                const RegexTerm *derivative = derive(item.second, symbol);
+                if (derivative->getKind() != RegexTerm::TK_Empty)
+                    nextKey.emplace_back(item.first, derivative);
+            }
+            if (!nextKey.empty())
+                targets[classID] = getState(std::move(nextKey));
+        }
+
+        for (unsigned lo = 0; lo <= MaxSymbolValue;) {
+            State *target = targets[classes[lo]];
+            unsigned hi = lo;
+            while (hi < MaxSymbolValue && targets[classes[hi + 1]] == target)
+                ++hi;
+            if (target)
+                state->connectTo(target, lo, hi);
+            lo = hi + 1;
+        }
+    }
+    dfa.IsDFA = true;
+    return dfa;
+}
+
+} // namespace dzieja
@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// This file contains the declaration of \c DerivativeDFABuilder — a builder of a DFA straight
+/// from regexes of tokens with Brzozowski derivatives, without building an NFA.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_UTILS_LEXGEN_REGEXDERIVATIVES_H
+#define DZIEJA_UTILS_LEXGEN_REGEXDERIVATIVES_H
+
+#include "FiniteAutomaton.h"
+#include "dzieja/Basic/TokenKinds.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dzieja {
+
+/// Set of bytes — the symbols regexes are matched over.
+class ByteSet {
+    std::array<uint64_t, 4> Words = {};
+
+public:
+    static ByteSet getRange(unsigned lo, unsigned hi);
+
+    bool contains(unsigned symbol) const { return Words[symbol / 64] >> (symbol % 64) & 1; }
+    bool empty() const { return Words == std::array<uint64_t, 4>{}; }
+
+    ByteSet &operator|=(const ByteSet &other);
+
+    bool operator==(const ByteSet &other) const { return Words == other.Words; }
+    bool operator<(const ByteSet &other) const { return Words < other.Words; }
+};
+
+/// Node of a regex over bytes. Terms are unique within their \c DerivativeDFABuilder and are built
+/// in a normal form, so similar terms (e.g. `a|b` and `b|a`) are the same object and are compared
+/// by pointers.
+class RegexTerm {
+public:
+    enum TermKind {
+        TK_Empty,   /// Matches nothing
+        TK_Epsilon, /// Matches the empty string only
+        TK_Bytes,   /// Matches one byte of the set
+        TK_Concat,  /// Matches the first operand followed by the second one
+        TK_Alt,     /// Matches any of the operands
+        TK_Star     /// Matches the operand repeated zero or more times
+    };
+
+private:
+    TermKind Kind;
+    bool Nullable;
+    unsigned ID;
+    ByteSet Bytes;
+    llvm::SmallVector<const RegexTerm *, 2> Operands;
+
+public:
+    RegexTerm(TermKind kind, bool nullable, unsigned id, const ByteSet &bytes,
+              llvm::ArrayRef<const RegexTerm *> operands)
+        : Kind(kind), Nullable(nullable), ID(id), Bytes(bytes),
+          Operands(operands.begin(), operands.end())
+    {
+    }
+
+    TermKind getKind() const { return Kind; }
+
+    /// Returns true if the term matches the empty string.
+    bool isNullable() const { return Nullable; }
+
+    /// Terms are numbered in order of their creation. The order is used to sort operands of
+    /// alternatives, so the result doesn't depend on addresses of terms.
+    unsigned getID() const { return ID; }
+
+    const ByteSet &getBytes() const { return Bytes; }
+    llvm::ArrayRef<const RegexTerm *> getOperands() const { return Operands; }
+};
+
+/// Builds the DFA of tokens directly from their regexes.
+///
+/// A state of the DFA is a list of the derivatives of the token regexes by the input read so far,
+/// and the derivative of a regex \c r by a byte \c a matches the strings \c s for which \c r
+/// matches `as`. Terms are normalized when they are built (`∅|r = r`, `εr = r`, `(r*)* = r*`,
+/// flattened and sorted alternatives), so equivalent derivatives mostly become the same term, and
+/// the number of states is finite. The DFA is close to the minimal one, but it isn't minimal in
+/// general, so it is usually minimized afterwards. Bytes are split into classes that give the same
+/// derivatives of all the terms of a state, so a derivative is computed once for a class instead of
+/// for every byte.
+class DerivativeDFABuilder {
+    using TermKey = std::tuple<RegexTerm::TermKind, ByteSet, std::vector<const RegexTerm *>>;
+
+    std::map<TermKey, std::unique_ptr<RegexTerm>> Terms;
+    llvm::DenseMap<std::pair<const RegexTerm *, unsigned>, const RegexTerm *> Derivatives;
+
+    /// Byte sets of a term splitting bytes into the classes with the same derivative.
+    llvm::DenseMap<const RegexTerm *, std::vector<ByteSet>> ClassSets;
+
+    /// Regexes of the tokens in order of their priority.
+    llvm::SmallVector<std::pair<const RegexTerm *, tok::TokenKind>, 0> Tokens;
+
+public:
+    void addRawString(const char *str, tok::TokenKind kind);
+
+    /// Parses a regex of the syntax \c NFA::parseRegex understands.
+    void addRegex(const char *regex, tok::TokenKind kind);
+
+    /// Builds the DFA of the added tokens. If several tokens match the same string, the one added
+    /// first wins.
+    NFA build();
+
+    size_t getNumTerms() const { return Terms.size(); }
+
+private:
+    const RegexTerm *getTerm(RegexTerm::TermKind kind, bool nullable, const ByteSet &bytes,
+                             llvm::ArrayRef<const RegexTerm *> operands);
+
+    const RegexTerm *getEmpty();
+    const RegexTerm *getEpsilon();
+    const RegexTerm *getBytes(const ByteSet &bytes);
+    const RegexTerm *getConcat(const RegexTerm *first, const RegexTerm *second);
+    const RegexTerm *getAlt(llvm::ArrayRef<const RegexTerm *> operands);
+    const RegexTerm *getStar(const RegexTerm *operand);
+
+    /// Returns the concatenation of \p terms.
+    const RegexTerm *getSequence(llvm::ArrayRef<const RegexTerm *> terms);
+
+    /// Returns the term matching the UTF-8 encoding of \p codePoint.
+    const RegexTerm *getCodePoint(llvm::UTF32 codePoint);
+
+    const RegexTerm *parseSequence(const char *&expr);
+    const RegexTerm *parseParen(const char *&expr);
+    const RegexTerm *parseSquare(const char *&expr);
+    const RegexTerm *parseQualifier(const char *&expr, const RegexTerm *term);
+    const RegexTerm *parseRepeat(const char *&expr, const RegexTerm *term);
+
+    /// Returns the derivative of \p term by \p symbol.
+    const RegexTerm *derive(const RegexTerm *term, unsigned char symbol);
+
+    /// Returns byte sets such that bytes which are either in or out of every set together give the
+    /// same derivative of \p term.
+    const std::vector<ByteSet> &getClassSets(const RegexTerm *term);
+};
+
+} // namespace dzieja
+
+#endif // DZIEJA_UTILS_LEXGEN_REGEXDERIVATIVES_H
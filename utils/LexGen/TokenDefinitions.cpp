@@ -0,0 +1,362 @@
+#include "TokenDefinitions.h"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/ConvertUTF.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/WithColor.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+using namespace llvm;
+
+namespace dzieja {
+
+GrammarDefinition getBuiltinGrammar()
+{
+    GrammarDefinition grammar;
+    unsigned mode = 0;
+#define MODE(name)                                                                                 \
+    mode = tok::mode_##name;                                                                       \
+    grammar.ModeNames.push_back(#name);
+#define TOKEN(name, str) grammar.Tokens.push_back({tok::name, #name, str, false, mode});
+#define TOKEN_REGEX(name, regex) grammar.Tokens.push_back({tok::name, #name, regex, true, mode});
+#define TOKEN_TO_MODE(name, str, next)                                                             \
+    grammar.Tokens.push_back({tok::name, #name, str, false, mode, tok::mode_##next});
+#define TOKEN_REGEX_TO_MODE(name, regex, next)                                                     \
+    grammar.Tokens.push_back({tok::name, #name, regex, true, mode, tok::mode_##next});
+#include "dzieja/Basic/TokenKinds.def"
+    return grammar;
+}
+
+namespace {
+
+/// Parser of the subset of C++ used in \c .def files of tokens.
+class DefParser {
+    StringRef Filename;
+    StringRef Text;
+    unsigned Line = 1;
+
+public:
+    DefParser(StringRef filename, StringRef text) : Filename(filename), Text(text) {}
+
+    bool parse(GrammarDefinition &result);
+
+private:
+    raw_ostream &error()
+    {
+        return WithColor::error(llvm::errs(), "dzieja-lexgen") << Filename << ":" << Line << ": ";
+    }
+
+    void skip(size_t n)
+    {
+        Line += Text.take_front(n).count('\n');
+        Text = Text.drop_front(n);
+    }
+
+    void skipSpacesAndComments();
+    bool parseIdentifier(std::string &result);
+    bool parseStringLiterals(std::string &result);
+    bool parseStringLiteral(std::string &result);
+    bool parseEscape(std::string &result);
+};
+
+} // namespace
+
+void DefParser::skipSpacesAndComments()
+{
+    for (;;) {
+        size_t numSpaces = Text.find_first_not_of(" \t\r\n\v\f");
+        skip(numSpaces == StringRef::npos ? Text.size() : numSpaces);
+        if (Text.startswith("//")) {
+            skip(Text.find('\n') == StringRef::npos ? Text.size() : Text.find('\n'));
+        }
+        else if (Text.startswith("/*")) {
+            size_t end = Text.find("*/");
+            skip(end == StringRef::npos ? Text.size() : end + 2);
+        }
+        else if (Text.startswith("#")) {
+            // a preprocessor line, maybe continued with backslashes
+            size_t end = 0;
+            while ((end = Text.find('\n', end)) != StringRef::npos && end > 0
+                   && Text[end - 1] == '\\')
+                ++end;
+            skip(end == StringRef::npos ? Text.size() : end);
+        }
+        else {
+            return;
+        }
+    }
+}
+
+bool DefParser::parseIdentifier(std::string &result)
+{
+    skipSpacesAndComments();
+    size_t length = 0;
+    while (length < Text.size() && (isAlnum(Text[length]) || Text[length] == '_'))
+        ++length;
+    if (length == 0 || isDigit(Text[0])) {
+        error() << "expected identifier\n";
+        return false;
+    }
+    result = Text.take_front(length).str();
+    skip(length);
+    return true;
+}
+
+bool DefParser::parseStringLiterals(std::string &result)
+{
+    // adjacent string literals are concatenated as in C++
+    result.clear();
+    skipSpacesAndComments();
+    if (!parseStringLiteral(result))
+        return false;
+    for (;;) {
+        skipSpacesAndComments();
+        if (!Text.startswith("\"") && !Text.startswith("R\"") && !Text.startswith("u8"))
+            break;
+        if (!parseStringLiteral(result))
+            return false;
+    }
+    if (result.find('\0') != std::string::npos) {
+        error() << "null character in a string literal is not supported, use the \\0 escape of "
+                   "a regular expression instead\n";
+        return false;
+    }
+    return true;
+}
+
+bool DefParser::parseStringLiteral(std::string &result)
+{
+    if (Text.startswith("u8"))
+        skip(2);
+
+    if (Text.startswith("R\"")) {
+        skip(2);
+        size_t paren = Text.find('(');
+        if (paren == StringRef::npos || paren > 16) {
+            error() << "invalid delimiter of a raw string literal\n";
+            return false;
+        }
+        std::string terminator = ")" + Text.take_front(paren).str() + "\"";
+        skip(paren + 1);
+        size_t end = Text.find(terminator);
+        if (end == StringRef::npos) {
+            error() << "unterminated raw string literal\n";
+            return false;
+        }
+        result += Text.take_front(end).str();
+        skip(end + terminator.size());
+        return true;
+    }
+
+    if (!Text.startswith("\"")) {
+        error() << "expected string literal\n";
+        return false;
+    }
+    skip(1);
+    while (!Text.empty() && Text[0] != '"') {
+        if (Text[0] == '\n')
+            break;
+        if (Text[0] == '\\') {
+            if (!parseEscape(result))
+                return false;
+            continue;
+        }
+        result += Text[0];
+        skip(1);
+    }
+    if (!Text.startswith("\"")) {
+        error() << "unterminated string literal\n";
+        return false;
+    }
+    skip(1);
+    return true;
+}
+
+bool DefParser::parseEscape(std::string &result)
+{
+    assert(Text.startswith("\\"));
+    skip(1);
+    if (Text.empty()) {
+        error() << "unterminated string literal\n";
+        return false;
+    }
+
+    char c = Text[0];
+    skip(1);
+    static const char SimpleEscapes[] = "abfnrtv\\'\"?";
+    static const char SimpleEscapeValues[] = "\a\b\f\n\r\t\v\\'\"?";
+    if (const char *escape = c ? std::strchr(SimpleEscapes, c) : nullptr) {
+        result += SimpleEscapeValues[escape - SimpleEscapes];
+        return true;
+    }
+
+    if (c >= '0' && c <= '7') {
+        unsigned value = c - '0';
+        for (int i = 0; i < 2 && !Text.empty() && Text[0] >= '0' && Text[0] <= '7'; ++i) {
+            value = value * 8 + (Text[0] - '0');
+            skip(1);
+        }
+        result += (char)value;
+        return true;
+    }
+
+    if (c == 'x' || c == 'u' || c == 'U') {
+        size_t maxDigits = c == 'x' ? 2 : c == 'u' ? 4 : 8;
+        size_t numDigits = 0;
+        while (numDigits < maxDigits && numDigits < Text.size() && isHexDigit(Text[numDigits]))
+            ++numDigits;
+        unsigned value;
+        if (numDigits == 0 || (c != 'x' && numDigits != maxDigits)
+            || Text.take_front(numDigits).getAsInteger(16, value)) {
+            error() << "invalid \\" << c << " escape sequence\n";
+            return false;
+        }
+        skip(numDigits);
+        if (c == 'x') {
+            result += (char)value;
+            return true;
+        }
+        char buffer[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+        char *end = buffer;
+        if (!ConvertCodePointToUTF8(value, end)) {
+            error() << "invalid code point in \\" << c << " escape sequence\n";
+            return false;
+        }
+        result.append(buffer, end);
+        return true;
+    }
+
+    error() << "unknown escape sequence '\\" << c << "'\n";
+    return false;
+}
+
+bool DefParser::parse(GrammarDefinition &result)
+{
+    result.ModeNames.clear();
+    result.Tokens.clear();
+    unsigned kind = 0;
+    unsigned mode = 0;
+
+    // target modes of *_TO_MODE tokens, they can be declared after the tokens
+    struct ModeReference {
+        size_t Token;
+        std::string Name;
+        unsigned Line;
+    };
+    std::vector<ModeReference> nextModes;
+
+    for (skipSpacesAndComments(); !Text.empty(); skipSpacesAndComments()) {
+        std::string macro;
+        if (!parseIdentifier(macro))
+            return false;
+
+        bool toMode = macro == "TOKEN_TO_MODE" || macro == "TOKEN_REGEX_TO_MODE";
+        bool hasPattern = macro == "TOKEN" || macro == "TOKEN_REGEX" || macro == "PUNCTUATOR"
+                          || macro == "TRIVIA" || toMode;
+        if (!hasPattern && macro != "TOK" && macro != "KEYWORD" && macro != "MODE") {
+            error() << "unknown macro '" << macro << "'\n";
+            return false;
+        }
+
+        TokenDefinition def;
+        skipSpacesAndComments();
+        if (!Text.startswith("(")) {
+            error() << "expected '(' after '" << macro << "'\n";
+            return false;
+        }
+        skip(1);
+        if (!parseIdentifier(def.Name))
+            return false;
+        if (hasPattern) {
+            skipSpacesAndComments();
+            if (!Text.startswith(",")) {
+                error() << "expected ',' after token name\n";
+                return false;
+            }
+            skip(1);
+            if (!parseStringLiterals(def.Pattern))
+                return false;
+        }
+        if (toMode) {
+            skipSpacesAndComments();
+            if (!Text.startswith(",")) {
+                error() << "expected ',' after token pattern\n";
+                return false;
+            }
+            skip(1);
+            ModeReference ref;
+            if (!parseIdentifier(ref.Name))
+                return false;
+            ref.Token = result.Tokens.size();
+            ref.Line = Line;
+            nextModes.push_back(std::move(ref));
+        }
+        skipSpacesAndComments();
+        if (!Text.startswith(")")) {
+            error() << "expected ')'\n";
+            return false;
+        }
+        skip(1);
+
+        if (macro == "MODE") {
+            if (llvm::is_contained(result.ModeNames, def.Name)) {
+                error() << "mode '" << def.Name << "' is already declared\n";
+                return false;
+            }
+            mode = result.ModeNames.size();
+            result.ModeNames.push_back(def.Name);
+            continue;
+        }
+
+        if (kind > std::numeric_limits<std::underlying_type<tok::TokenKind>::type>::max()) {
+            error() << "too many tokens\n";
+            return false;
+        }
+        if (kind == 0 && macro != "TOK") {
+            error() << "the first entry must be TOK, kind 0 is reserved for unknown tokens\n";
+            return false;
+        }
+        def.Kind = (tok::TokenKind)kind++;
+        if (macro == "TOK")
+            continue;
+
+        def.IsRegex = macro == "TOKEN_REGEX" || macro == "TRIVIA" || macro == "TOKEN_REGEX_TO_MODE";
+        def.Mode = mode;
+        if (macro == "KEYWORD") {
+            def.Pattern = def.Name;
+            def.Name = "kw_" + def.Name;
+        }
+        result.Tokens.push_back(std::move(def));
+    }
+
+    for (const ModeReference &ref : nextModes) {
+        auto iter = llvm::find(result.ModeNames, ref.Name);
+        if (iter == result.ModeNames.end()) {
+            Line = ref.Line;
+            error() << "unknown mode '" << ref.Name << "'\n";
+            return false;
+        }
+        result.Tokens[ref.Token].NextMode = iter - result.ModeNames.begin();
+    }
+    return true;
+}
+
+bool readGrammar(StringRef filename, GrammarDefinition &result)
+{
+    auto buffer = MemoryBuffer::getFile(filename);
+    if (!buffer) {
+        WithColor::error(llvm::errs(), "dzieja-lexgen")
+            << filename << ": " << buffer.getError().message() << "\n";
+        return false;
+    }
+    DefParser parser(filename, buffer.get()->getBuffer());
+    return parser.parse(result);
+}
+
+} // namespace dzieja
@@ -0,0 +1,68 @@
+//-----------------------------------------------------------------------------------*- C++ -*----//
+///
+/// \file
+/// This file contains the declaration of \c TokenDefinition and functions getting token
+/// definitions either from \c TokenKinds.def the tool is built with or from a \c .def file of
+/// another grammar at runtime.
+///
+//------------------------------------------------------------------------------------------------//
+
+#ifndef DZIEJA_UTILS_LEXGEN_TOKENDEFINITIONS_H
+#define DZIEJA_UTILS_LEXGEN_TOKENDEFINITIONS_H
+
+#include "dzieja/Basic/TokenKinds.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace dzieja {
+
+/// Value of \c TokenDefinition::NextMode for tokens that don't switch the lexer mode.
+constexpr unsigned NoModeChange = std::numeric_limits<unsigned>::max();
+
+/// Token of a grammar specified with either a raw string or a regular expression.
+///
+/// For a grammar other than \c TokenKinds.def, \c Kind is a value of that grammar's own kind
+/// enumeration kept in \c tok::TokenKind.
+struct TokenDefinition {
+    tok::TokenKind Kind;
+    std::string Name;
+    std::string Pattern;
+    bool IsRegex;
+
+    /// Index of the lexer mode the token is lexed in.
+    unsigned Mode = 0;
+
+    /// Index of the mode the lexer switches to after the token, or \c NoModeChange.
+    unsigned NextMode = NoModeChange;
+};
+
+/// Tokens and lexer modes (start conditions) of a grammar.
+struct GrammarDefinition {
+    /// Names of the modes in order of their \c MODE macros. It is empty if the grammar has no
+    /// modes, then all the tokens belong to the single implicit mode 0.
+    std::vector<std::string> ModeNames;
+
+    std::vector<TokenDefinition> Tokens;
+
+    unsigned getNumModes() const { return ModeNames.empty() ? 1 : ModeNames.size(); }
+};
+
+/// Returns tokens and modes of \c dzieja/Basic/TokenKinds.def.
+GrammarDefinition getBuiltinGrammar();
+
+/// Reads a grammar from a file in the format of \c TokenKinds.def: \c TOK, \c TOKEN,
+/// \c TOKEN_REGEX, \c KEYWORD, \c PUNCTUATOR, \c TRIVIA, \c MODE, \c TOKEN_TO_MODE and
+/// \c TOKEN_REGEX_TO_MODE macros, C++ comments and preprocessor lines.
+///
+/// Kinds are numbered from 0 in the order of the macros, as an enumeration built from the file
+/// with the \c TOK macro is. Kind 0 means "not a token", so the first entry must be \c TOK. Errors
+/// are reported, and false is returned.
+bool readGrammar(llvm::StringRef filename, GrammarDefinition &result);
+
+} // namespace dzieja
+
+#endif // DZIEJA_UTILS_LEXGEN_TOKENDEFINITIONS_H
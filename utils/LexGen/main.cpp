@@ -1,10 +1,21 @@
+#include "AutomatonCache.h"
 #include "FiniteAutomaton.h"
+#include "RegexDerivatives.h"
+#include "TokenDefinitions.h"
 #include "dzieja/Basic/TokenKinds.h"
 
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/WithColor.h>
 
+#include <chrono>
 #include <string>
+#include <vector>
 
 using namespace dzieja;
 using namespace llvm;
@@ -12,8 +23,52 @@ using namespace llvm;
 
 static cl::opt<std::string> Output("o", cl::desc("Specify output filename."), cl::init("a.inc"),
                                    cl::value_desc("filename"));
+static cl::opt<std::string>
+    InputFile("i", cl::init(""), cl::value_desc("filename"),
+              cl::desc("Read tokens from the specified .def file instead of the built-in\n"
+                       "dzieja/Basic/TokenKinds.def."));
+static cl::opt<std::string>
+    Prefix("prefix", cl::init(""), cl::value_desc("identifier"),
+           cl::desc("Prefix of all the generated names, so DFAs of several grammars\n"
+                    "can be used in one program."));
 static cl::opt<bool> NoMinimization("no-minimization", cl::init(false),
                                     cl::desc("Don't apply any minimization algorithm for DFA."));
+static cl::opt<bool>
+    NoNFAReduction("no-nfa-reduction", cl::init(false),
+                   cl::desc("Don't remove epsilon edges and merge equivalent states of NFA\n"
+                            "before building DFA."));
+static cl::opt<bool>
+    UseDerivatives("use-derivatives", cl::init(false),
+                   cl::desc("Build DFA straight from the regexes with Brzozowski derivatives\n"
+                            "instead of the subset construction of NFA. The automaton cache\n"
+                            "isn't used then."));
+static cl::opt<bool>
+    CheckDerivatives("check-derivatives", cl::init(false),
+                     cl::desc("Build DFA of every mode both via NFA and with derivatives, and\n"
+                              "fail if they differ."));
+static cl::opt<std::string>
+    CacheFile("cache", cl::init(""), cl::value_desc("filename"),
+              cl::desc("Keep automata of every token in the cache file and reuse them on\n"
+                       "the next run for tokens that are not changed."));
+static cl::list<std::string>
+    ProfileFiles("profile-use", cl::value_desc("filename"),
+                 cl::desc("Renumber DFA states in descending order of their visits in\n"
+                          "the profile written by the profiling build of dziejaLex. The\n"
+                          "option can be repeated, and the profiles are summed."));
+static cl::opt<std::string>
+    EmitDFAFile("emit-dfa", cl::init(""), cl::value_desc("filename"),
+                cl::desc("Also write the final DFA in the text format of the automaton\n"
+                         "cache, e.g. for compiling it at runtime with dziejaLexJIT."));
+static cl::opt<std::string>
+    EmitNFAFile("emit-nfa", cl::init(""), cl::value_desc("filename"),
+                cl::desc("Write the NFA of the grammar instead of generating the DFA, for\n"
+                         "the lazy DFA of dziejaLex. No DFA is built, so it works for\n"
+                         "grammars whose DFA is too large."));
+static cl::opt<std::string>
+    BinaryTables("emit-binary-tables", cl::init(""), cl::value_desc("basename"),
+                 cl::desc("Write the transitive and kind tables as raw data to <basename>.bin\n"
+                          "and the assembly file <basename>.S linking them with .incbin,\n"
+                          "so the inc-file only declares the tables."));
 static cl::opt<bool> Verbose("v", cl::init(false),
                              cl::desc("Print some information about a DFA building process."));
 static cl::opt<NFA::GeneratingMode>
@@ -22,21 +77,49 @@ static cl::opt<NFA::GeneratingMode>
             cl::values(clEnumValN(NFA::GM_Table, "gen-via-table",
                                   "Generate the function via transitive table (default)."),
                        clEnumValN(NFA::GM_Switch, "gen-via-switch",
-                                  "Generate the function via switch-case control flow.")));
+                                  "Generate the function via switch-case control flow."),
+                       clEnumValN(NFA::GM_Shuffle, "gen-via-shuffle",
+                                  "Also generate the table for SIMD byte shuffles if the\n"
+                                  "DFA has less than 16 states, otherwise it is the\n"
+                                  "same as -gen-via-table.")));
 
 static const char *Overview =
     "The program generates an inc-file with functions implementing DFA for\n"
     "          lexical analyze of text.\n";
 
-NFA buildNFA()
+/// Tokens and modes of the grammar the DFA is generated for.
+static GrammarDefinition Grammar;
+
+static void parseToken(NFA &nfa, const TokenDefinition &def)
+{
+    if (def.IsRegex)
+        nfa.parseRegex(def.Pattern.c_str(), def.Kind);
+    else
+        nfa.parseRawString(def.Pattern.c_str(), def.Kind);
+}
+
+/// Prints the name of \p mode before statistics of its automata if the grammar has several modes.
+static void printModeHeader(unsigned mode)
+{
+    if (Verbose && Grammar.getNumModes() > 1)
+        llvm::errs() << "Mode '" << Grammar.ModeNames[mode] << "':\n";
+}
+
+/// Builds NFA of the tokens lexed in \p mode.
+static NFA buildNFA(unsigned mode)
 {
     NFA nfa;
-#define TOKEN(name, str) nfa.parseRawString(str, tok::name);
-#define TOKEN_REGEX(name, regex) nfa.parseRegex(regex, tok::name);
-#include "dzieja/Basic/TokenKinds.def"
+    for (const auto &def : Grammar.Tokens)
+        if (def.Mode == mode)
+            parseToken(nfa, def);
 
-    if (Verbose)
-        llvm::errs() << "NFA has " << nfa.getNumStates() << " states.\n";
+    if (Verbose) {
+        llvm::errs() << "NFA has " << nfa.getNumStates() << " states and " << nfa.getNumEdges()
+                     << " edges.\n";
+        if (nfa.getNumRepeatStates())
+            llvm::errs() << nfa.getNumRepeatStates()
+                         << " of them are built for {m,n} quantifiers.\n";
+    }
 
 #define DEBUG_TYPE "nfa"
     LLVM_DEBUG(nfa.print(llvm::errs()) << "\n");
@@ -45,36 +128,419 @@ NFA buildNFA()
     return nfa;
 }
 
-int main(int argc, char *argv[])
+/// Reduces \p nfa before the subset construction if it isn't disabled.
+static void reduceNFA(NFA &nfa)
 {
-    cl::ParseCommandLineOptions(argc, argv, Overview);
+    if (NoNFAReduction)
+        return;
 
-    NFA nfa = buildNFA();
-    NFA dfa = nfa.buildDFA();
-    nfa.clear(); // clear heap
+    nfa = nfa.buildReducedNFA();
     if (Verbose)
-        llvm::errs() << "DFA has " << dfa.getNumStates() << " states.\n";
+        llvm::errs() << "Reduced NFA has " << nfa.getNumStates() << " states and "
+                     << nfa.getNumEdges() << " edges.\n";
 
-#define DEBUG_TYPE "dfa"
-    LLVM_DEBUG(dfa.print(llvm::errs()) << "\n");
+#define DEBUG_TYPE "reduced-nfa"
+    LLVM_DEBUG(nfa.print(llvm::errs()) << "\n");
 #undef DEBUG_TYPE
+}
 
-    if (NoMinimization) {
-        if (!dfa.generateCppImpl(Output.c_str(), GenMode))
-            return 1;
-        return 0;
-    }
+/// Minimizes \p dfa if it isn't disabled.
+static NFA minimizeDFA(NFA dfa)
+{
+    if (NoMinimization)
+        return dfa;
 
     NFA minDfa = dfa.buildMinimizedDFA();
     dfa.clear();
     if (Verbose)
-        llvm::errs() << "minDFA has " << minDfa.getNumStates() << " states.\n";
+        llvm::errs() << "minDFA has " << minDfa.getNumStates() << " states and "
+                     << minDfa.getNumEdges() << " edges.\n";
 
 #define DEBUG_TYPE "min-dfa"
     LLVM_DEBUG(minDfa.print(llvm::errs()) << "\n");
 #undef DEBUG_TYPE
 
-    if (!minDfa.generateCppImpl(Output.c_str(), GenMode))
+    return minDfa;
+}
+
+/// Builds DFA from \p nfa and minimizes it if it isn't disabled.
+static NFA buildFinalDFA(NFA &nfa)
+{
+    reduceNFA(nfa);
+    NFA dfa = nfa.buildDFA();
+    nfa.clear(); // clear heap
+    if (Verbose)
+        llvm::errs() << "DFA has " << dfa.getNumStates() << " states and " << dfa.getNumEdges()
+                     << " edges.\n";
+
+#define DEBUG_TYPE "dfa"
+    LLVM_DEBUG(dfa.print(llvm::errs()) << "\n");
+#undef DEBUG_TYPE
+
+    return minimizeDFA(std::move(dfa));
+}
+
+/// Builds DFA of the tokens lexed in \p mode with derivatives of their regexes and minimizes it if
+/// it isn't disabled.
+static NFA buildDerivativeDFA(unsigned mode)
+{
+    DerivativeDFABuilder builder;
+    for (const auto &def : Grammar.Tokens) {
+        if (def.Mode != mode)
+            continue;
+        if (def.IsRegex)
+            builder.addRegex(def.Pattern.c_str(), def.Kind);
+        else
+            builder.addRawString(def.Pattern.c_str(), def.Kind);
+    }
+    NFA dfa = builder.build();
+    if (Verbose)
+        llvm::errs() << "Derivative DFA has " << dfa.getNumStates() << " states and "
+                     << dfa.getNumEdges() << " edges, " << builder.getNumTerms()
+                     << " regex terms are built.\n";
+
+#define DEBUG_TYPE "derivative-dfa"
+    LLVM_DEBUG(dfa.print(llvm::errs()) << "\n");
+#undef DEBUG_TYPE
+
+    return minimizeDFA(std::move(dfa));
+}
+
+/// Returns the key of the token's DFA. States of the DFA keep the absolute kind of the token, so
+/// the kind is a part of the key, and a token renumbered by another token inserted before it is
+/// rebuilt. The DFA of a token is always minimized and built without the NFA reduction, so only
+/// the options of the automaton core are a part of the key.
+static std::string getCacheKey(const TokenDefinition &def)
+{
+    std::string key = def.Name;
+    key += " kind " + std::to_string(def.Kind);
+    key += " mode " + std::to_string(def.Mode);
+    if (def.NextMode != NoModeChange)
+        key += " next-mode " + std::to_string(def.NextMode);
+    key += def.IsRegex ? " regex " : " string ";
+    key += def.Pattern;
+    key += "\n" + getAutomatonOptions();
+    return key;
+}
+
+/// Builds the final DFA of \p mode reusing automata of the previous run.
+///
+/// If no token of the mode is changed, the final DFA is taken from \p cache as is. Otherwise every
+/// token gets its own minimized DFA, which is either taken from \p cache or built from scratch, and
+/// the final DFA is built from the union of those small DFAs instead of the raw NFA of all tokens.
+/// So only the automata of the changed tokens are built from their regexes, but the final DFA is
+/// still determinized and minimized in full. The order of the tokens is kept, so priorities of
+/// kinds are the same as for the usual way.
+///
+/// All the used automata, except the final one, are moved to \p newCache. The key of the final
+/// automaton is returned via \p finalKey.
+static NFA buildFinalDFAWithCache(AutomatonCache &cache, AutomatonCache &newCache, unsigned mode,
+                                  std::string &finalKey)
+{
+    // -no-minimization and -no-nfa-reduction affect the final DFA only
+    finalKey = "final mode " + std::to_string(mode);
+    finalKey += NoMinimization ? " no-minimization" : "";
+    finalKey += NoNFAReduction ? " no-nfa-reduction" : "";
+    unsigned numTokens = 0;
+    for (const auto &def : Grammar.Tokens) {
+        if (def.Mode != mode)
+            continue;
+        finalKey += "\n" + getCacheKey(def);
+        ++numTokens;
+    }
+
+    NFA finalDfa;
+    bool isFinalCached = cache.take(finalKey, finalDfa);
+    if (isFinalCached && Verbose)
+        llvm::errs() << "The final DFA is taken from the cache.\n";
+
+    NFA nfa;
+    unsigned numReused = 0;
+    size_t numRepeatStates = 0;
+    for (const auto &def : Grammar.Tokens) {
+        if (def.Mode != mode)
+            continue;
+        std::string key = getCacheKey(def);
+        NFA tokenDfa;
+        if (cache.take(key, tokenDfa)) {
+            ++numReused;
+        }
+        else {
+            NFA tokenNfa;
+            parseToken(tokenNfa, def);
+            numRepeatStates += tokenNfa.getNumRepeatStates();
+            tokenDfa = tokenNfa.buildDFA().buildMinimizedDFA();
+        }
+        if (!isFinalCached)
+            nfa.appendAutomaton(tokenDfa, def.Kind);
+        newCache.insert(key, std::move(tokenDfa));
+    }
+    if (isFinalCached)
+        return finalDfa;
+
+    if (Verbose) {
+        llvm::errs() << numReused << " of " << numTokens
+                     << " token DFAs are taken from the cache.\n";
+        if (numRepeatStates)
+            llvm::errs() << "NFAs of the rebuilt tokens have " << numRepeatStates
+                         << " states built for {m,n} quantifiers.\n";
+        llvm::errs() << "NFA of token DFAs has " << nfa.getNumStates() << " states and "
+                     << nfa.getNumEdges() << " edges.\n";
+    }
+    return buildFinalDFA(nfa);
+}
+
+/// Returns the modes tokens switch the lexer to, indexed by kinds, as \c NFA::joinModeAutomata
+/// expects.
+static SmallVector<unsigned, 0> getNextModes()
+{
+    SmallVector<unsigned, 0> nextModes;
+    for (const auto &def : Grammar.Tokens) {
+        if (def.Kind >= nextModes.size())
+            nextModes.resize(def.Kind + 1, NoModeChange);
+        nextModes[def.Kind] = def.NextMode;
+    }
+    return nextModes;
+}
+
+/// Writes the NFA of the grammar to \c EmitNFAFile without building any DFA.
+static bool emitNFA()
+{
+    std::vector<NFA> modeNfas;
+    for (unsigned mode = 0; mode < Grammar.getNumModes(); mode++) {
+        printModeHeader(mode);
+        modeNfas.push_back(buildNFA(mode));
+        reduceNFA(modeNfas.back());
+    }
+    NFA nfa = NFA::joinModeAutomata(modeNfas, getNextModes());
+
+    std::error_code EC;
+    raw_fd_ostream out(EmitNFAFile, EC);
+    if (EC) {
+        WithColor::error(llvm::errs(), "dzieja-lexgen")
+            << EmitNFAFile << ": " << EC.message() << "\n";
+        return false;
+    }
+    nfa.write(out);
+    return true;
+}
+
+/// Builds the DFA of the grammar: every mode gets its own minimized DFA, and they are joined into
+/// one table. If \p cache is not null, automata are reused as \p buildFinalDFAWithCache does, and
+/// all the used automata are moved to \p newCache.
+static NFA buildModeDFAs(AutomatonCache *cache, AutomatonCache *newCache)
+{
+    std::vector<NFA> modeDfas;
+    std::vector<std::string> finalKeys(Grammar.getNumModes());
+    for (unsigned mode = 0; mode < Grammar.getNumModes(); mode++) {
+        printModeHeader(mode);
+        if (cache) {
+            modeDfas.push_back(buildFinalDFAWithCache(*cache, *newCache, mode, finalKeys[mode]));
+        }
+        else if (UseDerivatives) {
+            modeDfas.push_back(buildDerivativeDFA(mode));
+        }
+        else {
+            NFA nfa = buildNFA(mode);
+            modeDfas.push_back(buildFinalDFA(nfa));
+        }
+    }
+
+    NFA dfa = NFA::joinModeAutomata(modeDfas, getNextModes());
+    if (Verbose && modeDfas.size() > 1)
+        llvm::errs() << "DFA of " << modeDfas.size() << " modes has " << dfa.getNumStates()
+                     << " states and " << dfa.getNumEdges() << " edges.\n";
+
+    if (newCache)
+        for (unsigned mode = 0; mode < modeDfas.size(); mode++)
+            newCache->insert(finalKeys[mode], std::move(modeDfas[mode]));
+    return dfa;
+}
+
+/// Builds DFA of every mode both via NFA and with derivatives and compares them. Returns false if
+/// they differ.
+static bool checkDerivatives()
+{
+    using Clock = std::chrono::steady_clock;
+    for (unsigned mode = 0; mode < Grammar.getNumModes(); mode++) {
+        printModeHeader(mode);
+        Clock::time_point start = Clock::now();
+        NFA nfa = buildNFA(mode);
+        NFA dfa = buildFinalDFA(nfa);
+        Clock::time_point middle = Clock::now();
+        NFA derivativeDfa = buildDerivativeDFA(mode);
+        Clock::time_point end = Clock::now();
+        if (Verbose) {
+            auto getMilliseconds = [](Clock::duration duration) {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+            };
+            llvm::errs() << "DFA is built via NFA in " << getMilliseconds(middle - start)
+                         << " ms and with derivatives in " << getMilliseconds(end - middle)
+                         << " ms.\n";
+        }
+        if (!dfa.isEquivalentDFA(derivativeDfa)) {
+            WithColor::error(llvm::errs(), "dzieja-lexgen")
+                << "DFA built with derivatives differs from DFA built via NFA";
+            if (Grammar.getNumModes() > 1)
+                llvm::errs() << " in mode '" << Grammar.ModeNames[mode] << "'";
+            llvm::errs() << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Adds state visits from the profile \p filename to \p visits, which is indexed by canonical
+/// state IDs. Returns false if the profile is not readable or is built for another DFA, i.e. its
+/// hash differs from \p dfaHash (see \c NFA::getCanonicalHash).
+static bool readProfile(StringRef filename, uint32_t dfaHash, SmallVectorImpl<uint64_t> &visits)
+{
+    auto buffer = MemoryBuffer::getFile(filename);
+    if (!buffer) {
+        WithColor::warning(llvm::errs(), "dzieja-lexgen")
+            << filename << ": " << buffer.getError().message() << "\n";
+        return false;
+    }
+
+    // dzieja-lex-profile <version> <number of states> <hash of the DFA>
+    // state <canonical ID> <visits>
+    // transition <canonical ID> <symbol> <count>
+    // kind <token name> <count>
+    SmallVector<StringRef, 0> lines;
+    buffer.get()->getBuffer().split(lines, '\n', -1, false);
+    SmallVector<StringRef, 4> fields;
+    if (!lines.empty())
+        lines[0].split(fields, ' ');
+    unsigned numStates;
+    uint32_t hash;
+    if (fields.size() != 4 || fields[0] != "dzieja-lex-profile" || fields[1] != "2"
+        || fields[2].getAsInteger(10, numStates) || numStates != visits.size()
+        || fields[3].getAsInteger(10, hash) || hash != dfaHash) {
+        WithColor::warning(llvm::errs(), "dzieja-lexgen")
+            << filename << ": the profile doesn't match the DFA, it is ignored\n";
+        return false;
+    }
+
+    for (StringRef line : llvm::drop_begin(lines)) {
+        fields.clear();
+        line.split(fields, ' ');
+        unsigned id;
+        uint64_t count;
+        if (fields[0] != "state")
+            continue;
+        if (fields.size() != 3 || fields[1].getAsInteger(10, id) || id >= numStates
+            || fields[2].getAsInteger(10, count)) {
+            WithColor::warning(llvm::errs(), "dzieja-lexgen")
+                << filename << ": malformed line '" << line << "', the profile is ignored\n";
+            return false;
+        }
+        visits[id] += count;
+    }
+    return true;
+}
+
+/// Writes the output files for \p dfa: the generated code, the binary tables if
+/// \c -emit-binary-tables is specified, and the DFA itself if \c -emit-dfa is specified.
+static bool writeOutput(const NFA &dfa)
+{
+    NFA::GeneratingMode mode = GenMode;
+    if (mode == NFA::GM_Shuffle && !dfa.fitsShuffleTable()) {
+        if (Verbose)
+            llvm::errs() << "The DFA has too many states for the shuffle table, it is generated "
+                            "via the transitive table only.\n";
+        mode = NFA::GM_Table;
+    }
+    if (!dfa.generateCppImpl(Output.c_str(), mode, Prefix, BinaryTables))
+        return false;
+    if (EmitDFAFile.empty())
+        return true;
+
+    std::error_code EC;
+    raw_fd_ostream out(EmitDFAFile, EC);
+    if (EC) {
+        WithColor::error(llvm::errs(), "dzieja-lexgen")
+            << EmitDFAFile << ": " << EC.message() << "\n";
+        return false;
+    }
+    dfa.write(out);
+    return true;
+}
+
+/// Generates the output file. If profiles are specified, states of \p dfa are renumbered by
+/// hotness before, so the hottest rows of the transitive table are close to each other.
+static bool generate(const NFA &dfa)
+{
+    if (ProfileFiles.empty())
+        return writeOutput(dfa);
+
+    SmallVector<uint64_t, 0> visits(dfa.getNumStates());
+    uint32_t dfaHash = dfa.getCanonicalHash();
+    for (const std::string &filename : ProfileFiles) {
+        SmallVector<uint64_t, 0> fileVisits(dfa.getNumStates());
+        if (!readProfile(filename, dfaHash, fileVisits))
+            continue;
+        for (size_t i = 0; i < visits.size(); i++)
+            visits[i] += fileVisits[i];
+    }
+
+    if (Verbose) {
+        SmallVector<uint64_t, 0> sorted(visits.begin(), visits.end());
+        llvm::sort(sorted, [](uint64_t l, uint64_t r) { return l > r; });
+        uint64_t total = 0, hot = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            total += sorted[i];
+            hot += i < 8 ? sorted[i] : 0;
+        }
+        size_t numVisited = llvm::count_if(sorted, [](uint64_t n) { return n != 0; });
+        llvm::errs() << numVisited << " of " << sorted.size()
+                     << " states are visited in the profile, the hottest 8 states take "
+                     << (total ? hot * 100 / total : 0) << "% of visits.\n";
+    }
+    return writeOutput(dfa.buildRenumberedDFA(visits));
+}
+
+/// Returns the MD5 hash of the executable. Automata cached by another build of the tool, which
+/// might build them differently, aren't reused then.
+static std::string getToolID(const char *argv0)
+{
+    std::string path = sys::fs::getMainExecutable(argv0, (void *)&getToolID);
+    auto buffer = MemoryBuffer::getFile(path);
+    if (!buffer)
+        return "";
+    MD5 hash;
+    hash.update(buffer.get()->getBuffer());
+    MD5::MD5Result result;
+    hash.final(result);
+    return result.digest().str().str();
+}
+
+int main(int argc, char *argv[])
+{
+    cl::ParseCommandLineOptions(argc, argv, Overview);
+
+    if (!Prefix.empty() && !llvm::all_of(Prefix, [](char c) { return isAlnum(c) || c == '_'; })) {
+        WithColor::error(llvm::errs(), "dzieja-lexgen") << "prefix must be an identifier\n";
+        return 1;
+    }
+    if (InputFile.empty())
+        Grammar = getBuiltinGrammar();
+    else if (!readGrammar(InputFile, Grammar))
+        return 1;
+
+    if (CheckDerivatives && !checkDerivatives())
+        return 1;
+    if (!EmitNFAFile.empty())
+        return emitNFA() ? 0 : 1;
+    if (CacheFile.empty() || UseDerivatives)
+        return generate(buildModeDFAs(nullptr, nullptr)) ? 0 : 1;
+
+    std::string toolID = getToolID(argv[0]);
+    AutomatonCache cache(toolID), newCache(toolID);
+    cache.load(CacheFile);
+    NFA dfa = buildModeDFAs(&cache, &newCache);
+    if (!generate(dfa))
+        return 1;
+    if (!newCache.save(CacheFile))
         return 1;
     return 0;
 }